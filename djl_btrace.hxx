@@ -0,0 +1,442 @@
+#pragma once
+
+//
+// Low-overhead binary tracing. Cheap enough to leave enabled in hot loops.
+//
+// Each thread appends fixed-size 64-byte records (timestamp, thread id, format-string id, up to 6 arguments)
+// to its own single-producer / single-consumer ring. No locks are taken and nothing is formatted on the
+// calling thread. A background thread periodically drains the rings to the binary trace file. If a ring is
+// full the record is dropped and counted rather than blocking the caller.
+//
+// Format strings are registered once per call site; use the BTRACE macro so the registration is cached:
+//    CDJLBinaryTrace btracer;                  // in one source file
+//    btracer.Enable( true, "osc.btr" );
+//    BTRACE( "render samples %u..%u, %d channels\n", first, last, channels );
+//
+// Arguments must be integers, floating point, or pointers; strings are not captured. Decode the file to
+// text with CDJLBinaryTrace::Decode() -- oscbt.exe is a thin wrapper around it.
+//
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <ctype.h>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+#include <djl_os.hxx>
+
+using namespace std;
+
+class CDJLBinaryTrace
+{
+    public:
+        static const uint32_t MaxArgs = 6;
+
+        enum ArgType : uint16_t { argSigned = 0, argUnsigned = 1, argDouble = 2, argPointer = 3 };
+
+        #pragma pack( push, 1 )
+
+            struct TraceRecord
+            {
+                uint64_t ticks;           // nanoseconds since Enable()
+                uint32_t threadId;        // small per-process ordinal, not the OS thread id
+                uint16_t formatId;        // index into the registered format strings
+                uint16_t argInfo;         // count in the top 4 bits, then a 2-bit ArgType per argument
+                uint64_t args[ MaxArgs ];
+            };
+
+            struct BlockHeader
+            {
+                uint32_t tag;             // blockFormat or blockRecords
+                uint32_t count;           // byte length of the format string or count of records
+                uint32_t id;              // format id for blockFormat, 0 otherwise
+            };
+
+        #pragma pack( pop )
+
+        static const uint32_t blockFormat = 0x544d4f46;   // "FOMT"
+        static const uint32_t blockRecords = 0x53434552;  // "RECS"
+
+    private:
+        static const uint32_t RingRecords = 4096;         // must be a power of 2; 256k per thread
+        static const uint32_t FlushIntervalMS = 50;
+
+        struct Ring
+        {
+            atomic<uint32_t> head;                        // written only by the owning thread
+            atomic<uint32_t> tail;                        // written only by the flusher
+            uint32_t threadId;
+            TraceRecord records[ RingRecords ];
+
+            Ring( uint32_t id ) : head( 0 ), tail( 0 ), threadId( id ) {}
+        };
+
+        FILE * fp;
+        atomic<bool> enabled;
+        atomic<bool> stopFlusher;
+        atomic<uint64_t> dropped;
+        thread flusher;
+        mutex mtx;                                        // guards rings and formats; never taken per record
+        vector<unique_ptr<Ring>> rings;
+        vector<const char *> formats;
+        size_t formatsWritten;
+        chrono::steady_clock::time_point tStart;
+
+        static uint64_t ArgBits( double d ) { uint64_t u; memcpy( &u, &d, sizeof u ); return u; }
+
+        static void PackArg( uint64_t * args, uint16_t & info, uint32_t i, ArgType t, uint64_t v )
+        {
+            args[ i ] = v;
+            info |= (uint16_t) ( t << ( 2 * i ) );
+        } //PackArg
+
+        static void PackArg( uint64_t * args, uint16_t & info, uint32_t i, double d ) { PackArg( args, info, i, argDouble, ArgBits( d ) ); }
+        static void PackArg( uint64_t * args, uint16_t & info, uint32_t i, float f ) { PackArg( args, info, i, argDouble, ArgBits( f ) ); }
+        static void PackArg( uint64_t * args, uint16_t & info, uint32_t i, const void * p ) { PackArg( args, info, i, argPointer, (uint64_t) (uintptr_t) p ); }
+
+        template <class T> static void PackArg( uint64_t * args, uint16_t & info, uint32_t i, T v )
+        {
+            static_assert( is_integral<T>::value || is_enum<T>::value, "binary trace arguments must be numbers or pointers" );
+
+            if ( is_enum<T>::value || is_signed<T>::value )
+                PackArg( args, info, i, argSigned, (uint64_t) (int64_t) v );
+            else
+                PackArg( args, info, i, argUnsigned, (uint64_t) v );
+        } //PackArg
+
+        template <class T> static void PackArg( uint64_t * args, uint16_t & info, uint32_t i, T * p ) { PackArg( args, info, i, (const void *) p ); }
+
+        Ring * GetRing()
+        {
+            // rings live as long as the tracer, so the cached pointer stays valid across Enable() cycles
+
+            thread_local Ring * ring = 0;
+
+            if ( 0 == ring )
+            {
+                lock_guard<mutex> lock( mtx );
+                rings.emplace_back( new Ring( (uint32_t) rings.size() ) );
+                ring = rings.back().get();
+            }
+
+            return ring;
+        } //GetRing
+
+        void WriteBlock( uint32_t tag, uint32_t count, uint32_t id, const void * pv, size_t cb )
+        {
+            BlockHeader bh = { tag, count, id };
+            fwrite( &bh, sizeof bh, 1, fp );
+            if ( 0 != cb )
+                fwrite( pv, cb, 1, fp );
+        } //WriteBlock
+
+        void Drain()
+        {
+            lock_guard<mutex> lock( mtx );
+
+            // formats are written before any record that can reference them
+
+            for ( ; formatsWritten < formats.size(); formatsWritten++ )
+            {
+                const char * pf = formats[ formatsWritten ];
+                uint32_t len = (uint32_t) strlen( pf );
+                WriteBlock( blockFormat, len, (uint32_t) formatsWritten, pf, len );
+            }
+
+            for ( size_t r = 0; r < rings.size(); r++ )
+            {
+                Ring & ring = * rings[ r ];
+                uint32_t tail = ring.tail.load( memory_order_relaxed );
+                uint32_t head = ring.head.load( memory_order_acquire );
+
+                while ( tail != head )
+                {
+                    // write contiguous runs; the ring may wrap once
+
+                    uint32_t start = tail & ( RingRecords - 1 );
+                    uint32_t run = get_min( head - tail, RingRecords - start );
+                    WriteBlock( blockRecords, run, 0, & ring.records[ start ], run * sizeof( TraceRecord ) );
+                    tail += run;
+                }
+
+                ring.tail.store( tail, memory_order_release );
+            }
+
+            fflush( fp );
+        } //Drain
+
+        void FlusherThread()
+        {
+            while ( !stopFlusher.load( memory_order_relaxed ) )
+            {
+                sleep_ms( FlushIntervalMS );
+                Drain();
+            }
+
+            Drain();
+        } //FlusherThread
+
+    public:
+        CDJLBinaryTrace() : fp( 0 ), enabled( false ), stopFlusher( false ), dropped( 0 ), formatsWritten( 0 ) {}
+
+        ~CDJLBinaryTrace()
+        {
+            Shutdown();
+        } //~CDJLBinaryTrace
+
+        bool Enable( bool enable, const char * pcLogFile )
+        {
+            Shutdown();
+
+            if ( enable && 0 != pcLogFile )
+            {
+                fp = fopen( pcLogFile, "wb" );
+
+                if ( 0 != fp )
+                {
+                    fwrite( "DJLBTRC1", 8, 1, fp );
+                    formatsWritten = 0; // call sites cache their format ids, so re-emit them all
+                    dropped = 0;
+                    tStart = chrono::steady_clock::now();
+                    stopFlusher = false;
+                    flusher = thread( &CDJLBinaryTrace::FlusherThread, this );
+                    enabled = true;
+                }
+            }
+
+            return ( 0 != fp );
+        } //Enable
+
+        bool Enable( bool enable, const wchar_t * pwcLogFile )
+        {
+            if ( 0 == pwcLogFile )
+                return Enable( enable, (const char *) 0 );
+
+            size_t len = wcslen( pwcLogFile );
+            vector<char> narrow( 1 + len );
+            wcstombs( narrow.data(), pwcLogFile, 1 + len );
+            return Enable( enable, narrow.data() );
+        } //Enable
+
+        void Shutdown()
+        {
+            if ( 0 != fp )
+            {
+                enabled = false;
+                stopFlusher = true;
+                flusher.join();
+
+                uint64_t d = dropped;
+                if ( 0 != d )
+                {
+                    static const uint16_t droppedId = RegisterFormat( "%llu records were dropped because a ring was full\n" );
+                    Drain();
+                    TraceRecord rec = {};
+                    rec.formatId = droppedId;
+                    rec.argInfo = (uint16_t) ( ( 1 << 12 ) | argUnsigned );
+                    rec.args[ 0 ] = d;
+                    WriteBlock( blockRecords, 1, 0, &rec, sizeof rec );
+                }
+
+                fclose( fp );
+                fp = 0;
+            }
+        } //Shutdown
+
+        bool IsEnabled() { return enabled.load( memory_order_relaxed ); }
+
+        uint16_t RegisterFormat( const char * format )
+        {
+            lock_guard<mutex> lock( mtx );
+            formats.push_back( format );
+            return (uint16_t) ( formats.size() - 1 );
+        } //RegisterFormat
+
+        template <class... Args> void Record( uint16_t formatId, Args... args )
+        {
+            static_assert( sizeof...( args ) <= MaxArgs, "too many binary trace arguments" );
+
+            if ( !enabled.load( memory_order_relaxed ) )
+                return;
+
+            Ring * ring = GetRing();
+            uint32_t head = ring->head.load( memory_order_relaxed );
+
+            if ( ( head - ring->tail.load( memory_order_acquire ) ) >= RingRecords )
+            {
+                dropped.fetch_add( 1, memory_order_relaxed );
+                return;
+            }
+
+            TraceRecord & rec = ring->records[ head & ( RingRecords - 1 ) ];
+            rec.ticks = (uint64_t) chrono::duration_cast<chrono::nanoseconds>( chrono::steady_clock::now() - tStart ).count();
+            rec.threadId = ring->threadId;
+            rec.formatId = formatId;
+
+            uint16_t info = (uint16_t) ( sizeof...( args ) << 12 );
+            uint32_t i = 0;
+            int expand[] = { 0, ( PackArg( rec.args, info, i++, args ), 0 )... };
+            (void) expand;
+            rec.argInfo = info;
+
+            ring->head.store( head + 1, memory_order_release );
+        } //Record
+
+        // Convert a binary trace file to text, one line per record. Returns false if the file isn't a trace.
+
+        static bool Decode( FILE * fpIn, FILE * fpOut )
+        {
+            char magic[ 8 ];
+            if ( 1 != fread( magic, sizeof magic, 1, fpIn ) || memcmp( magic, "DJLBTRC1", sizeof magic ) )
+                return false;
+
+            vector<string> fmts;
+            BlockHeader bh;
+
+            while ( 1 == fread( &bh, sizeof bh, 1, fpIn ) )
+            {
+                if ( blockFormat == bh.tag )
+                {
+                    string s( bh.count, 0 );
+                    if ( 0 != bh.count && 1 != fread( &s[ 0 ], bh.count, 1, fpIn ) )
+                        return false;
+
+                    if ( fmts.size() <= bh.id )
+                        fmts.resize( 1 + bh.id );
+                    fmts[ bh.id ] = s;
+                }
+                else if ( blockRecords == bh.tag )
+                {
+                    for ( uint32_t r = 0; r < bh.count; r++ )
+                    {
+                        TraceRecord rec;
+                        if ( 1 != fread( &rec, sizeof rec, 1, fpIn ) )
+                            return false;
+
+                        fprintf( fpOut, "%12.6lf T%-3u ", (double) rec.ticks / 1000000.0, rec.threadId );
+
+                        if ( rec.formatId < fmts.size() )
+                            DecodeRecord( fpOut, fmts[ rec.formatId ].c_str(), rec );
+                        else
+                            fprintf( fpOut, "<unknown format id %u>\n", rec.formatId );
+                    }
+                }
+                else
+                    return false;
+            }
+
+            return true;
+        } //Decode
+
+    private:
+
+        // Walk the format string and print each conversion with its captured argument. Length modifiers in
+        // the original are replaced because every argument was widened to 64 bits when recorded.
+
+        static void DecodeRecord( FILE * fpOut, const char * pf, TraceRecord & rec )
+        {
+            uint32_t argCount = rec.argInfo >> 12;
+            uint32_t a = 0;
+            string spec;
+
+            while ( *pf )
+            {
+                if ( '%' != *pf )
+                {
+                    fputc( *pf++, fpOut );
+                    continue;
+                }
+
+                if ( '%' == pf[ 1 ] )
+                {
+                    fputc( '%', fpOut );
+                    pf += 2;
+                    continue;
+                }
+
+                spec = "%";
+                pf++;
+
+                while ( *pf && strchr( "-+ #0123456789.*", *pf ) )
+                    spec += *pf++;
+
+                while ( *pf && strchr( "hlLqjztIw", *pf ) )
+                {
+                    // skip I64 and I32 along with the modifier
+
+                    if ( 'I' == *pf && isdigit( pf[ 1 ] ) && isdigit( pf[ 2 ] ) )
+                        pf += 2;
+                    pf++;
+                }
+
+                char conv = *pf;
+                if ( 0 == conv )
+                    break;
+                pf++;
+
+                if ( a >= argCount )
+                {
+                    fprintf( fpOut, "<missing>" );
+                    continue;
+                }
+
+                ArgType t = (ArgType) ( ( rec.argInfo >> ( 2 * a ) ) & 3 );
+                uint64_t v = rec.args[ a++ ];
+
+                if ( strchr( "eEfFgGaA", conv ) )
+                {
+                    double d;
+                    memcpy( &d, &v, sizeof d );
+                    if ( argDouble != t )
+                        d = ( argSigned == t ) ? (double) (int64_t) v : (double) v;
+                    spec += conv;
+                    fprintf( fpOut, spec.c_str(), d );
+                }
+                else if ( strchr( "diouxXc", conv ) )
+                {
+                    if ( argDouble == t )
+                    {
+                        double d;
+                        memcpy( &d, &v, sizeof d );
+                        v = (uint64_t) (int64_t) d;
+                    }
+
+                    if ( 'c' == conv )
+                    {
+                        spec += 'c';
+                        fprintf( fpOut, spec.c_str(), (int) v );
+                    }
+                    else
+                    {
+                        spec += "ll";
+                        spec += conv;
+                        fprintf( fpOut, spec.c_str(), (unsigned long long) v );
+                    }
+                }
+                else if ( 'p' == conv )
+                    fprintf( fpOut, "%#llx", (unsigned long long) v );
+                else
+                    fprintf( fpOut, "<%c not captured>", conv );
+            }
+        } //DecodeRecord
+}; //CDJLBinaryTrace
+
+extern CDJLBinaryTrace btracer;
+
+// Registers the format string once per call site, then records without locking or formatting
+
+#define BTRACE( format, ... )                                                        \
+    do                                                                               \
+    {                                                                                \
+        if ( btracer.IsEnabled() )                                                   \
+        {                                                                            \
+            static const uint16_t _btraceId = btracer.RegisterFormat( format );      \
+            btracer.Record( _btraceId, ##__VA_ARGS__ );                              \
+        }                                                                            \
+    } while ( false )
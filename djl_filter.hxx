@@ -0,0 +1,435 @@
+#pragma once
+
+//
+// Cascaded biquad filters applied to multichannel sample data before it's displayed.
+//
+// CFilterChain holds the stages and parses specs like "hp20,n60,lp8000":
+//    hpN   2nd order Butterworth high-pass at N Hz
+//    lpN   2nd order Butterworth low-pass at N Hz
+//    bpN   band-pass centered at N Hz (Q 2)
+//    nN    notch at N Hz and its harmonics, e.g. n50 or n60 for mains hum
+//
+// CFilterCache evaluates a chain lazily in fixed-size blocks and keeps the results, so panning and zooming
+// only filter blocks that haven't been seen. A block whose predecessor is cached continues from that
+// block's final filter state; otherwise the filter is warmed up on a prefix long enough for the slowest
+// stage's transient to decay. All channels are run through the same stage together, two at a time with SSE2.
+// The cache never exceeds its memory budget; ranges wider than the budget aren't filtered.
+//
+
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <assert.h>
+#include <vector>
+#include <memory>
+#include <string>
+#include <functional>
+#include <unordered_map>
+#include <djl_os.hxx>
+
+#if defined( _M_AMD64 ) || defined( __amd64 )
+    #include <emmintrin.h>
+    #define DJL_FILTER_SSE2
+#endif
+
+using namespace std;
+
+struct Biquad
+{
+    // transposed direct form II; a0 is normalized to 1
+
+    double b0, b1, b2, a1, a2;
+
+    static Biquad Make( double b0, double b1, double b2, double a0, double a1, double a2 )
+    {
+        Biquad bq = { b0 / a0, b1 / a0, b2 / a0, a1 / a0, a2 / a0 };
+        return bq;
+    } //Make
+
+    // Coefficients are from Robert Bristow-Johnson's Audio EQ Cookbook
+
+    static Biquad LowPass( double hz, double q, double rate )
+    {
+        double w = 2.0 * 3.141592653589793 * hz / rate;
+        double alpha = sin( w ) / ( 2.0 * q );
+        double c = cos( w );
+        return Make( ( 1.0 - c ) / 2.0, 1.0 - c, ( 1.0 - c ) / 2.0, 1.0 + alpha, -2.0 * c, 1.0 - alpha );
+    } //LowPass
+
+    static Biquad HighPass( double hz, double q, double rate )
+    {
+        double w = 2.0 * 3.141592653589793 * hz / rate;
+        double alpha = sin( w ) / ( 2.0 * q );
+        double c = cos( w );
+        return Make( ( 1.0 + c ) / 2.0, -( 1.0 + c ), ( 1.0 + c ) / 2.0, 1.0 + alpha, -2.0 * c, 1.0 - alpha );
+    } //HighPass
+
+    static Biquad BandPass( double hz, double q, double rate )
+    {
+        // constant 0 dB peak gain
+
+        double w = 2.0 * 3.141592653589793 * hz / rate;
+        double alpha = sin( w ) / ( 2.0 * q );
+        double c = cos( w );
+        return Make( alpha, 0.0, -alpha, 1.0 + alpha, -2.0 * c, 1.0 - alpha );
+    } //BandPass
+
+    static Biquad Notch( double hz, double q, double rate )
+    {
+        double w = 2.0 * 3.141592653589793 * hz / rate;
+        double alpha = sin( w ) / ( 2.0 * q );
+        double c = cos( w );
+        return Make( 1.0, -2.0 * c, 1.0, 1.0 + alpha, -2.0 * c, 1.0 - alpha );
+    } //Notch
+
+    // Samples until the impulse response falls below about -80 dB; used to size the warm-up prefix
+
+    uint64_t DecaySamples()
+    {
+        double disc = a1 * a1 - 4.0 * a2;
+        double radius;
+
+        if ( disc < 0.0 )
+            radius = sqrt( a2 );
+        else
+            radius = ( fabs( -a1 ) + sqrt( disc ) ) / 2.0;
+
+        if ( radius <= 0.0 )
+            return 2;
+        if ( radius >= 1.0 )
+            return ~ (uint64_t) 0;
+
+        return 2 + (uint64_t) ( log( 1e-4 ) / log( radius ) );
+    } //DecaySamples
+};
+
+class CFilterChain
+{
+    private:
+        vector<Biquad> stages;
+        string description;
+
+    public:
+        bool IsEmpty() { return stages.empty(); }
+        size_t Stages() { return stages.size(); }
+        const Biquad & Stage( size_t i ) { return stages[ i ]; }
+        const char * Description() { return description.c_str(); }
+
+        void Clear()
+        {
+            stages.clear();
+            description.clear();
+        } //Clear
+
+        void Add( const Biquad & bq ) { stages.push_back( bq ); }
+
+        // Returns false and leaves the chain empty if the spec is malformed or a frequency is out of range
+
+        bool Parse( const char * spec, double rate )
+        {
+            Clear();
+            const double nyquist = rate / 2.0;
+            const char * p = spec;
+
+            while ( *p )
+            {
+                const char * item = p;
+                int type = tolower( *p );
+                if ( 'h' == type || 'l' == type || 'b' == type )
+                {
+                    if ( 'p' != tolower( p[ 1 ] ) )
+                        break;
+                    p += 2;
+                }
+                else if ( 'n' == type )
+                    p++;
+                else
+                    break;
+
+                char * pend = 0;
+                double hz = strtod( p, &pend );
+                if ( pend == p || hz <= 0.0 || hz >= nyquist )
+                    break;
+                p = pend;
+
+                if ( 'h' == type )
+                    Add( Biquad::HighPass( hz, 0.7071067811865476, rate ) );
+                else if ( 'l' == type )
+                    Add( Biquad::LowPass( hz, 0.7071067811865476, rate ) );
+                else if ( 'b' == type )
+                    Add( Biquad::BandPass( hz, 2.0, rate ) );
+                else
+                {
+                    // mains hum shows up at the fundamental and many harmonics
+
+                    const int maxHarmonics = 8;
+                    for ( int h = 1; h <= maxHarmonics && ( hz * h ) < ( nyquist * 0.9 ); h++ )
+                        Add( Biquad::Notch( hz * h, 30.0, rate ) );
+                }
+
+                if ( !description.empty() )
+                    description += ' ';
+                description.append( item, p - item );
+
+                if ( ',' == *p )
+                    p++;
+                else if ( 0 != *p )
+                    break;
+            }
+
+            if ( 0 != *p || stages.empty() )
+            {
+                Clear();
+                return false;
+            }
+
+            return true;
+        } //Parse
+
+        uint64_t WarmupSamples()
+        {
+            // a very narrow notch near DC can take minutes to settle; past this the residue isn't visible
+
+            const uint64_t maxWarmup = 1 << 20;
+            uint64_t warmup = 0;
+            for ( size_t i = 0; i < stages.size(); i++ )
+            {
+                uint64_t d = stages[ i ].DecaySamples();
+                if ( d > warmup )
+                    warmup = d;
+            }
+
+            return get_min( warmup, maxWarmup );
+        } //WarmupSamples
+}; //CFilterChain
+
+class CFilterCache
+{
+    public:
+        // Fills count samples starting at first. Channel c of sample i goes to pdata[ i * stride + c ]
+
+        typedef function<void( uint64_t first, uint32_t count, double * pdata, uint32_t stride )> SourceReader;
+
+        static const uint32_t BlockShift = 12;
+        static const uint32_t BlockSamples = 1 << BlockShift;
+
+    private:
+        struct Block
+        {
+            uint64_t index;
+            uint64_t lastUse;
+            vector<float> out;                // BlockSamples * stride
+            vector<double> endState;          // filter state after the last sample of the block
+        };
+
+        CFilterChain chain;
+        SourceReader reader;
+        uint32_t channels;
+        uint32_t stride;                      // channels rounded up to an even count for SSE2
+        uint64_t samples;
+        uint64_t warmup;
+        uint64_t useCounter;
+        size_t maxBlocks;
+        vector<unique_ptr<Block>> blocks;
+        unordered_map<uint64_t, Block *> blockMap;   // index => block, so lookups don't scan every block
+        vector<Block *> window;               // blocks covering the last Prepare() range
+        uint64_t windowFirstBlock;
+        vector<double> work;
+        vector<double> state;
+
+        Block * Find( uint64_t index )
+        {
+            auto it = blockMap.find( index );
+            return ( blockMap.end() == it ) ? 0 : it->second;
+        } //Find
+
+        Block * NewBlock( uint64_t index, uint64_t firstInUse )
+        {
+            // reuse the least recently used block that's not part of the range being prepared.
+            // Prepare() never spans more than maxBlocks, so there's always one outside that range
+
+            if ( blocks.size() >= maxBlocks )
+            {
+                size_t victim = blocks.size();
+                for ( size_t i = 0; i < blocks.size(); i++ )
+                    if ( blocks[ i ]->index < firstInUse || blocks[ i ]->index >= index )
+                        if ( victim == blocks.size() || blocks[ i ]->lastUse < blocks[ victim ]->lastUse )
+                            victim = i;
+
+                assert( victim < blocks.size() );
+                blockMap.erase( blocks[ victim ]->index );
+                blocks[ victim ]->index = index;
+                blockMap[ index ] = blocks[ victim ].get();
+                return blocks[ victim ].get();
+            }
+
+            unique_ptr<Block> blk( new Block() );
+            blk->index = index;
+            blk->out.resize( (size_t) BlockSamples * stride );
+            blk->endState.resize( state.size() );
+            blockMap[ index ] = blk.get();
+            blocks.push_back( move( blk ) );
+            return blocks.back().get();
+        } //NewBlock
+
+        // Run count samples in work through every stage, in place
+
+        void Run( uint32_t count )
+        {
+            for ( size_t st = 0; st < chain.Stages(); st++ )
+            {
+                const Biquad & bq = chain.Stage( st );
+                double * z1 = state.data() + st * 2 * stride;
+                double * z2 = z1 + stride;
+
+#ifdef DJL_FILTER_SSE2
+                const __m128d b0 = _mm_set1_pd( bq.b0 ), b1 = _mm_set1_pd( bq.b1 ), b2 = _mm_set1_pd( bq.b2 );
+                const __m128d a1 = _mm_set1_pd( bq.a1 ), a2 = _mm_set1_pd( bq.a2 );
+
+                for ( uint32_t ch = 0; ch < stride; ch += 2 )
+                {
+                    __m128d s1 = _mm_loadu_pd( z1 + ch );
+                    __m128d s2 = _mm_loadu_pd( z2 + ch );
+                    double * px = work.data() + ch;
+
+                    for ( uint32_t s = 0; s < count; s++, px += stride )
+                    {
+                        __m128d x = _mm_loadu_pd( px );
+                        __m128d y = _mm_add_pd( _mm_mul_pd( b0, x ), s1 );
+                        s1 = _mm_add_pd( _mm_sub_pd( _mm_mul_pd( b1, x ), _mm_mul_pd( a1, y ) ), s2 );
+                        s2 = _mm_sub_pd( _mm_mul_pd( b2, x ), _mm_mul_pd( a2, y ) );
+                        _mm_storeu_pd( px, y );
+                    }
+
+                    _mm_storeu_pd( z1 + ch, s1 );
+                    _mm_storeu_pd( z2 + ch, s2 );
+                }
+#else
+                for ( uint32_t ch = 0; ch < stride; ch++ )
+                {
+                    double s1 = z1[ ch ], s2 = z2[ ch ];
+                    double * px = work.data() + ch;
+
+                    for ( uint32_t s = 0; s < count; s++, px += stride )
+                    {
+                        double x = *px;
+                        double y = bq.b0 * x + s1;
+                        s1 = bq.b1 * x - bq.a1 * y + s2;
+                        s2 = bq.b2 * x - bq.a2 * y;
+                        *px = y;
+                    }
+
+                    z1[ ch ] = s1;
+                    z2[ ch ] = s2;
+                }
+#endif
+            }
+        } //Run
+
+        uint32_t ReadAndRun( uint64_t first )
+        {
+            uint32_t count = (uint32_t) get_min( (uint64_t) BlockSamples, samples - first );
+            reader( first, count, work.data(), stride );
+            Run( count );
+            return count;
+        } //ReadAndRun
+
+        void Compute( Block * blk )
+        {
+            uint64_t first = blk->index << BlockShift;
+            Block * prev = ( 0 == blk->index ) ? 0 : Find( blk->index - 1 );
+
+            if ( 0 != prev )
+                state = prev->endState;
+            else
+            {
+                fill( state.begin(), state.end(), 0.0 );
+
+                // run the prefix from block-aligned starts so the reads match how blocks are read
+
+                uint64_t warmStart = ( first > warmup ) ? ( ( first - warmup ) & ~ (uint64_t) ( BlockSamples - 1 ) ) : 0;
+                for ( uint64_t w = warmStart; w < first; w += BlockSamples )
+                    ReadAndRun( w );
+            }
+
+            uint32_t count = ReadAndRun( first );
+            size_t values = (size_t) count * stride;
+            for ( size_t i = 0; i < values; i++ )
+                blk->out[ i ] = (float) work[ i ];
+
+            blk->endState = state;
+        } //Compute
+
+    public:
+        CFilterCache() : channels( 0 ), stride( 0 ), samples( 0 ), warmup( 0 ), useCounter( 0 ), maxBlocks( 0 ), windowFirstBlock( 0 ) {}
+
+        void Init( uint32_t chans, uint64_t totalSamples, SourceReader r, size_t maxBytes = 64 * 1024 * 1024 )
+        {
+            channels = chans;
+            stride = ( chans + 1 ) & ~1;
+            samples = totalSamples;
+            reader = r;
+            size_t blockBytes = (size_t) BlockSamples * stride * sizeof( float );
+            maxBlocks = get_max( (size_t) 4, maxBytes / blockBytes );
+            work.resize( (size_t) BlockSamples * stride );
+            Invalidate();
+        } //Init
+
+        void SetChain( CFilterChain & c )
+        {
+            chain = c;
+            warmup = chain.WarmupSamples();
+            Invalidate();
+        } //SetChain
+
+        void Invalidate()
+        {
+            blocks.clear();
+            blockMap.clear();
+            window.clear();
+            state.assign( chain.Stages() * 2 * stride, 0.0 );
+        } //Invalidate
+
+        bool IsActive() { return !chain.IsEmpty() && 0 != channels; }
+
+        // Make samples [ first, last ) available to Get(). Not thread safe, but Get() is once this returns.
+        // Returns false without filtering anything if the range needs more blocks than the memory budget allows
+
+        bool Prepare( uint64_t first, uint64_t last )
+        {
+            window.clear();
+            last = get_min( last, samples );
+            if ( first >= last )
+                return true;
+
+            windowFirstBlock = first >> BlockShift;
+            uint64_t lastBlock = ( last - 1 ) >> BlockShift;
+            if ( ( lastBlock - windowFirstBlock + 1 ) > maxBlocks )
+                return false;
+
+            useCounter++;
+
+            for ( uint64_t b = windowFirstBlock; b <= lastBlock; b++ )
+            {
+                Block * blk = Find( b );
+                if ( 0 == blk )
+                {
+                    blk = NewBlock( b, windowFirstBlock );
+                    Compute( blk );
+                }
+
+                blk->lastUse = useCounter;
+                window.push_back( blk );
+            }
+
+            return true;
+        } //Prepare
+
+        double Get( uint64_t s, uint32_t channel )
+        {
+            Block * blk = window[ (size_t) ( ( s >> BlockShift ) - windowFirstBlock ) ];
+            return (double) blk->out[ (size_t) ( s & ( BlockSamples - 1 ) ) * stride + channel ];
+        } //Get
+}; //CFilterCache
@@ -0,0 +1,134 @@
+#pragma once
+
+//
+// Persistent 32bpp framebuffers that are reused from frame to frame.
+//
+// CFrameBuffer is attached to memory owned by someone else (e.g. a DIB section), so rendering happens
+// directly into the memory that's presented or encoded. It tracks the rectangle written since the last
+// clear so a frame only erases what the prior frame drew.
+// CFramePool hands out a fixed set of frames round-robin; nothing is allocated once sizes are stable.
+// Nothing here depends on Windows.
+//
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <assert.h>
+
+class CFrameBuffer
+{
+    public:
+        struct FrameRect
+        {
+            int left, top, right, bottom;     // right and bottom are exclusive
+
+            bool IsEmpty() const { return ( left >= right ) || ( top >= bottom ); }
+        };
+
+    private:
+        uint32_t * pixels;                    // top row
+        int width;
+        int height;
+        int strideBy4;                        // in pixels, not bytes; may be negative for bottom-up memory
+        FrameRect dirty;
+
+        void ResetDirty() { dirty.left = width; dirty.top = height; dirty.right = 0; dirty.bottom = 0; }
+
+    public:
+        CFrameBuffer() : pixels( 0 ), width( 0 ), height( 0 ), strideBy4( 0 ) { ResetDirty(); }
+
+        // Render into memory owned by the caller, which must outlive this object or the next Attach
+
+        void Attach( uint32_t * topRow, int w, int h, int stride )
+        {
+            pixels = topRow;
+            width = w;
+            height = h;
+            strideBy4 = stride;
+            ResetDirty();
+        } //Attach
+
+        bool IsValid() const { return ( 0 != pixels ); }
+        bool IsSize( int w, int h ) const { return IsValid() && ( w == width ) && ( h == height ); }
+        int Width() const { return width; }
+        int Height() const { return height; }
+        int StrideBy4() const { return strideBy4; }
+        uint32_t * Row( int y ) { assert( y >= 0 && y < height ); return pixels + (ptrdiff_t) y * strideBy4; }
+        const FrameRect & Dirty() const { return dirty; }
+
+        // Callers write pixels directly (e.g. from many threads), so they report the area up front
+
+        void MarkDirty( int left, int top, int right, int bottom )
+        {
+            if ( left < 0 ) left = 0;
+            if ( top < 0 ) top = 0;
+            if ( right > width ) right = width;
+            if ( bottom > height ) bottom = height;
+
+            if ( left < dirty.left ) dirty.left = left;
+            if ( top < dirty.top ) dirty.top = top;
+            if ( right > dirty.right ) dirty.right = right;
+            if ( bottom > dirty.bottom ) dirty.bottom = bottom;
+        } //MarkDirty
+
+        // Erase just the area written since the last clear
+
+        void ClearDirty( uint32_t color )
+        {
+            if ( !dirty.IsEmpty() )
+                FillRect( dirty.left, dirty.top, dirty.right, dirty.bottom, color );
+
+            ResetDirty();
+        } //ClearDirty
+
+        void Fill( uint32_t color )
+        {
+            FillRect( 0, 0, width, height, color );
+            ResetDirty();
+        } //Fill
+
+        // Fill without affecting dirty tracking; used for static content like borders
+
+        void FillRect( int left, int top, int right, int bottom, uint32_t color )
+        {
+            for ( int y = top; y < bottom; y++ )
+            {
+                uint32_t * p = Row( y );
+
+                if ( 0 == color )
+                    memset( p + left, 0, sizeof( uint32_t ) * ( right - left ) );
+                else
+                    for ( int x = left; x < right; x++ )
+                        p[ x ] = color;
+            }
+        } //FillRect
+
+        void HLine( int x, int x2, int y, uint32_t color ) { FillRect( x, y, x2 + 1, y + 1, color ); }
+        void VLine( int x, int y, int y2, uint32_t color ) { FillRect( x, y, x + 1, y2 + 1, color ); }
+}; //CFrameBuffer
+
+// Frames are constructed once and reused forever; T typically wraps a CFrameBuffer plus platform state.
+
+template <class T, size_t N> class CFramePool
+{
+    private:
+        T frames[ N ];
+        size_t next;
+
+    public:
+        CFramePool() : next( 0 ) {}
+
+        size_t Count() { return N; }
+        T & operator[] ( size_t i ) { assert( i < N ); return frames[ i ]; }
+
+        // The frame to render into next. The prior frame is untouched until this one is Completed
+
+        T & Acquire() { return frames[ next ]; }
+
+        void Complete( T & frame )
+        {
+            size_t i = &frame - frames;
+            assert( i < N );
+            next = ( i + 1 ) % N;
+        } //Complete
+}; //CFramePool
@@ -0,0 +1,437 @@
+#pragma once
+
+//
+// Lossless compressed in-memory store for multichannel integer samples.
+//
+// Each channel is split into fixed blocks of BlockSamples samples. A block is predicted with a fixed
+// polynomial predictor (order 0, 1, or 2; whichever yields the smallest residuals), the residuals are
+// zigzag encoded, and then bit-packed at a single width per block. Bits are packed in 4 interleaved lanes
+// (sample i is in lane i % 4) so SSE2 unpacks 4 residuals per step.
+// Locating a block is an array lookup. Get() decodes blocks on demand into a small per-thread LRU, so
+// renderers can call it from many threads without locks. Each thread keeps up to Ways blocks for each
+// channel it reads.
+// Values are opaque 32-bit integers; callers map their format to and from them.
+// Nothing here depends on Windows.
+//
+
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <thread>
+#include <functional>
+#include <djl_os.hxx>
+
+#if defined( _M_AMD64 ) || defined( __amd64 )
+    #include <emmintrin.h>
+    #define DJL_PACKED_SSE2
+#endif
+
+using namespace std;
+
+class CPackedSamples
+{
+    public:
+        // Fills count samples starting at first. Channel c of sample i goes to pdata[ i * stride + c ].
+        // Called concurrently from multiple threads during Build().
+
+        typedef function<void( uint64_t first, uint32_t count, int32_t * pdata, uint32_t stride )> SourceReader;
+
+        static const uint32_t BlockShift = 12;
+        static const uint32_t BlockSamples = 1 << BlockShift;
+        static const uint32_t Ways = 4;
+
+    private:
+        static const uint32_t Lanes = 4;
+        static const uint32_t HeaderWords = 2;      // order | width << 8, then the first sample
+        static const uint32_t MaxBlockWords = HeaderWords + BlockSamples;
+        static const uint32_t SegmentShift = 20;    // 4MB segments, so growth never copies the whole store
+        static const uint64_t SegmentWords = (uint64_t) 1 << SegmentShift;
+
+        struct Way
+        {
+            uint64_t block;                         // block index + 1; 0 when empty
+            uint64_t lastUse;
+            vector<int32_t> values;
+        };
+
+        struct ThreadCache
+        {
+            uint64_t owner;                         // id of the store whose blocks are cached
+            uint64_t useCounter;
+            vector<Way> ways;                       // Ways per channel
+
+            ThreadCache() : owner( 0 ), useCounter( 0 ) {}
+        };
+
+        struct Segments
+        {
+            vector<unique_ptr<uint32_t[]>> list;
+            uint64_t used;                          // words used in the last segment
+
+            Segments() : used( SegmentWords ) {}
+
+            uint64_t Reserve( uint32_t words )
+            {
+                if ( used + words > SegmentWords )
+                {
+                    list.push_back( unique_ptr<uint32_t[]>( new uint32_t[ SegmentWords ] ) );
+                    used = 0;
+                }
+
+                return ( (uint64_t) ( list.size() - 1 ) << SegmentShift ) + used;
+            } //Reserve
+        };
+
+        uint32_t channels;
+        uint64_t samples;
+        uint64_t id;
+        uint64_t compressedWords;
+        vector<unique_ptr<uint32_t[]>> segments;
+        vector<uint64_t> locations;                 // block * channels + channel => segment << SegmentShift | word
+
+        static ThreadCache & LocalCache()
+        {
+            static thread_local ThreadCache tc;
+            return tc;
+        } //LocalCache
+
+        static uint64_t NextId()
+        {
+            static atomic<uint64_t> nextId( 0 );
+            return ++nextId;
+        } //NextId
+
+        static uint32_t ZigZag( uint32_t v ) { return ( v << 1 ) ^ (uint32_t) ( (int32_t) v >> 31 ); }
+
+        // Writes the block to out and returns the count of words used. r is scratch for 3 * BlockSamples
+
+        static uint32_t Encode( const int32_t * px, uint32_t stride, uint32_t count, uint32_t * r, uint32_t * out )
+        {
+            assert( count > 0 && count <= BlockSamples );
+
+            // residuals for each order, with wrapping math. Sample 0 is in the header and residuals past count are 0
+
+            uint32_t * r0 = r;
+            uint32_t * r1 = r + BlockSamples;
+            uint32_t * r2 = r1 + BlockSamples;
+            uint32_t or0 = 0, or1 = 0, or2 = 0;
+            uint32_t prev = (uint32_t) px[ 0 ];
+            uint32_t prevDelta = 0;
+
+            r0[ 0 ] = ZigZag( prev );
+            r1[ 0 ] = r2[ 0 ] = 0;
+            or0 = r0[ 0 ];
+
+            for ( uint32_t i = 1; i < count; i++ )
+            {
+                uint32_t x = (uint32_t) px[ (size_t) i * stride ];
+                uint32_t delta = x - prev;
+                r0[ i ] = ZigZag( x );
+                r1[ i ] = ZigZag( delta );
+                r2[ i ] = ZigZag( delta - prevDelta );
+                or0 |= r0[ i ];
+                or1 |= r1[ i ];
+                or2 |= r2[ i ];
+                prev = x;
+                prevDelta = delta;
+            }
+
+            for ( uint32_t i = count; i < BlockSamples; i++ )
+                r0[ i ] = r1[ i ] = r2[ i ] = 0;
+
+            uint32_t bits[ 3 ] = { 0, 0, 0 };
+            uint32_t ors[ 3 ] = { or0, or1, or2 };
+            for ( uint32_t o = 0; o < 3; o++ )
+                while ( bits[ o ] < 32 && 0 != ( ors[ o ] >> bits[ o ] ) )
+                    bits[ o ]++;
+
+            uint32_t order = 0;
+            for ( uint32_t o = 1; o < 3; o++ )
+                if ( bits[ o ] < bits[ order ] )
+                    order = o;
+
+            const uint32_t width = bits[ order ];
+            const uint32_t * pr = r + (size_t) order * BlockSamples;
+
+            out[ 0 ] = order | ( width << 8 );
+            out[ 1 ] = (uint32_t) px[ 0 ];
+
+            // lane l holds samples l, l + 4, l + 8, ... and its word j is at out[ HeaderWords + j * Lanes + l ]
+
+            for ( uint32_t l = 0; l < Lanes; l++ )
+            {
+                uint64_t acc = 0;
+                uint32_t accBits = 0;
+                uint32_t * pw = out + HeaderWords + l;
+
+                for ( uint32_t i = l; i < BlockSamples; i += Lanes )
+                {
+                    acc |= (uint64_t) pr[ i ] << accBits;
+                    accBits += width;
+
+                    if ( accBits >= 32 )
+                    {
+                        *pw = (uint32_t) acc;
+                        pw += Lanes;
+                        acc >>= 32;
+                        accBits -= 32;
+                    }
+                }
+
+                assert( 0 == accBits );
+            }
+
+            return HeaderWords + width * ( BlockSamples / 32 );
+        } //Encode
+
+        static void Decode( const uint32_t * block, int32_t * pout )
+        {
+            const uint32_t order = block[ 0 ] & 0xff;
+            const uint32_t width = ( block[ 0 ] >> 8 ) & 0xff;
+            const uint32_t seed = block[ 1 ];
+            const uint32_t * pw = block + HeaderWords;
+            uint32_t * out = (uint32_t *) pout;
+
+#ifdef DJL_PACKED_SSE2
+            if ( 0 == width )
+                memset( out, 0, BlockSamples * sizeof( uint32_t ) );
+            else
+            {
+                const __m128i mask = _mm_set1_epi32( ( 32 == width ) ? -1 : (int) ( ( 1u << width ) - 1 ) );
+                const __m128i one = _mm_set1_epi32( 1 );
+                const __m128i zero = _mm_setzero_si128();
+                const __m128i * pin = (const __m128i *) pw;
+                const __m128i * pend = pin + width * ( BlockSamples / Lanes / 32 );
+                __m128i cur = _mm_loadu_si128( pin++ );
+                uint32_t shift = 0;
+
+                for ( uint32_t i = 0; i < BlockSamples; i += Lanes )
+                {
+                    __m128i v = _mm_srl_epi32( cur, _mm_cvtsi32_si128( (int) shift ) );
+                    shift += width;
+
+                    if ( shift >= 32 )
+                    {
+                        shift -= 32;
+
+                        if ( pin < pend )
+                        {
+                            cur = _mm_loadu_si128( pin++ );
+                            if ( 0 != shift )
+                                v = _mm_or_si128( v, _mm_sll_epi32( cur, _mm_cvtsi32_si128( (int) ( width - shift ) ) ) );
+                        }
+                    }
+
+                    v = _mm_and_si128( v, mask );
+
+                    // undo the zigzag
+
+                    v = _mm_xor_si128( _mm_srli_epi32( v, 1 ), _mm_sub_epi32( zero, _mm_and_si128( v, one ) ) );
+                    _mm_storeu_si128( (__m128i *) ( out + i ), v );
+                }
+            }
+
+            // each order of prediction is undone by a running sum; 4 at a time with the carry broadcast
+
+            for ( uint32_t o = order; o > 0; o-- )
+            {
+                __m128i carry = _mm_set1_epi32( ( 1 == o ) ? (int) seed : 0 );
+
+                for ( uint32_t i = 0; i < BlockSamples; i += Lanes )
+                {
+                    __m128i v = _mm_loadu_si128( (const __m128i *) ( out + i ) );
+                    v = _mm_add_epi32( v, _mm_slli_si128( v, 4 ) );
+                    v = _mm_add_epi32( v, _mm_slli_si128( v, 8 ) );
+                    v = _mm_add_epi32( v, carry );
+                    carry = _mm_shuffle_epi32( v, 0xff );
+                    _mm_storeu_si128( (__m128i *) ( out + i ), v );
+                }
+            }
+#else
+            const uint32_t mask = ( 32 == width ) ? 0xffffffff : ( ( 1u << width ) - 1 );
+
+            for ( uint32_t l = 0; l < Lanes; l++ )
+            {
+                const uint32_t * plane = pw + l;
+                uint64_t acc = 0;
+                uint32_t accBits = 0;
+
+                for ( uint32_t i = l; i < BlockSamples; i += Lanes )
+                {
+                    if ( accBits < width )
+                    {
+                        acc |= (uint64_t) *plane << accBits;
+                        plane += Lanes;
+                        accBits += 32;
+                    }
+
+                    uint32_t v = (uint32_t) acc & mask;
+                    acc >>= width;
+                    accBits -= width;
+                    out[ i ] = ( v >> 1 ) ^ ( 0 - ( v & 1 ) );
+                }
+            }
+
+            for ( uint32_t o = order; o > 0; o-- )
+            {
+                uint32_t sum = ( 1 == o ) ? seed : 0;
+
+                for ( uint32_t i = 0; i < BlockSamples; i++ )
+                {
+                    sum += out[ i ];
+                    out[ i ] = sum;
+                }
+            }
+#endif
+
+            assert( (uint32_t) pout[ 0 ] == seed );
+        } //Decode
+
+        // Encode blocks [ firstBlock, endBlock ) of all channels into seg. Locations are relative to seg
+
+        void EncodeRange( SourceReader & reader, uint64_t firstBlock, uint64_t endBlock, Segments & seg )
+        {
+            vector<int32_t> raw( (size_t) BlockSamples * channels );
+            vector<uint32_t> scratch( (size_t) BlockSamples * 3 );
+
+            for ( uint64_t b = firstBlock; b < endBlock; b++ )
+            {
+                uint64_t first = b << BlockShift;
+                uint32_t count = (uint32_t) get_min( (uint64_t) BlockSamples, samples - first );
+                reader( first, count, raw.data(), channels );
+
+                for ( uint32_t ch = 0; ch < channels; ch++ )
+                {
+                    uint64_t loc = seg.Reserve( MaxBlockWords );
+                    uint32_t * out = seg.list.back().get() + seg.used;
+                    seg.used += Encode( raw.data() + ch, channels, count, scratch.data(), out );
+                    locations[ (size_t) ( b * channels + ch ) ] = loc;
+                }
+            }
+        } //EncodeRange
+
+    public:
+        CPackedSamples() : channels( 0 ), samples( 0 ), id( 0 ), compressedWords( 0 ) {}
+
+        // Reads every sample once. Blocks are encoded on up to threads threads; 0 means one per core
+
+        bool Build( uint32_t chans, uint64_t totalSamples, SourceReader reader, uint32_t threads = 0 )
+        {
+            channels = chans;
+            samples = totalSamples;
+            segments.clear();
+            locations.clear();
+            compressedWords = 0;
+            id = NextId();
+
+            if ( 0 == channels || 0 == samples )
+                return false;
+
+            uint64_t blockCount = ( samples + BlockSamples - 1 ) >> BlockShift;
+            locations.resize( (size_t) ( blockCount * channels ) );
+
+            if ( 0 == threads )
+                threads = get_max( 1u, thread::hardware_concurrency() );
+            threads = (uint32_t) get_min( (uint64_t) threads, blockCount );
+
+            vector<Segments> workerSegments( threads );
+            vector<thread> workers;
+            uint64_t perWorker = ( blockCount + threads - 1 ) / threads;
+
+            for ( uint32_t t = 0; t < threads; t++ )
+            {
+                uint64_t firstBlock = t * perWorker;
+                uint64_t endBlock = get_min( blockCount, firstBlock + perWorker );
+                workers.push_back( thread( [=, &reader, &workerSegments] ()
+                    { EncodeRange( reader, firstBlock, endBlock, workerSegments[ t ] ); } ) );
+            }
+
+            for ( size_t t = 0; t < workers.size(); t++ )
+                workers[ t ].join();
+
+            // append each worker's segments and rebase its locations. The partial last segments are trimmed
+
+            for ( uint32_t t = 0; t < threads; t++ )
+            {
+                Segments & seg = workerSegments[ t ];
+                if ( seg.list.empty() )
+                    continue;
+
+                uint64_t base = (uint64_t) segments.size() << SegmentShift;
+                uint64_t firstLoc = t * perWorker * channels;
+                uint64_t endLoc = get_min( blockCount, ( t + 1 ) * perWorker ) * channels;
+
+                for ( uint64_t l = firstLoc; l < endLoc; l++ )
+                    locations[ (size_t) l ] += base;
+
+                unique_ptr<uint32_t[]> last( new uint32_t[ (size_t) seg.used ] );
+                memcpy( last.get(), seg.list.back().get(), (size_t) seg.used * sizeof( uint32_t ) );
+                seg.list.back() = move( last );
+
+                compressedWords += ( (uint64_t) ( seg.list.size() - 1 ) << SegmentShift ) + seg.used;
+
+                for ( size_t s = 0; s < seg.list.size(); s++ )
+                    segments.push_back( move( seg.list[ s ] ) );
+            }
+
+            return true;
+        } //Build
+
+        bool IsValid() const { return 0 != id; }
+        uint32_t Channels() const { return channels; }
+        uint64_t Samples() const { return samples; }
+        uint64_t CompressedBytes() const { return compressedWords * sizeof( uint32_t ) + locations.size() * sizeof( uint64_t ); }
+
+        int32_t Get( uint64_t s, uint32_t channel )
+        {
+            assert( s < samples && channel < channels );
+
+            ThreadCache & tc = LocalCache();
+            if ( tc.owner != id )
+            {
+                tc.ways.resize( (size_t) channels * Ways );
+                for ( size_t w = 0; w < tc.ways.size(); w++ )
+                {
+                    tc.ways[ w ].block = 0;
+                    tc.ways[ w ].lastUse = 0;
+                }
+                tc.owner = id;
+            }
+
+            const uint64_t key = ( s >> BlockShift ) + 1;
+            Way * set = tc.ways.data() + (size_t) channel * Ways;
+            Way * way = 0;
+
+            for ( uint32_t w = 0; w < Ways; w++ )
+            {
+                if ( key == set[ w ].block )
+                {
+                    way = set + w;
+                    break;
+                }
+            }
+
+            if ( 0 == way )
+            {
+                way = set;
+                for ( uint32_t w = 1; w < Ways; w++ )
+                    if ( set[ w ].lastUse < way->lastUse )
+                        way = set + w;
+
+                // decoded blocks are only allocated for channels this thread actually reads
+
+                if ( way->values.empty() )
+                    way->values.resize( BlockSamples );
+
+                uint64_t loc = locations[ (size_t) ( ( key - 1 ) * channels + channel ) ];
+                Decode( segments[ (size_t) ( loc >> SegmentShift ) ].get() + ( loc & ( SegmentWords - 1 ) ), way->values.data() );
+                way->block = key;
+            }
+
+            way->lastUse = ++tc.useCounter;
+            return way->values[ (size_t) ( s & ( BlockSamples - 1 ) ) ];
+        } //Get
+}; //CPackedSamples
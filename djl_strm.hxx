@@ -170,6 +170,7 @@ class CStream
         } //Seek
 
         bool Ok() { return ( INVALID_HANDLE_VALUE != hFile ); }
+        HANDLE Handle() { return hFile; }
         __int64 Tell() { return offset; }
         __int64 Length() { return length; }
         bool AtEOF() { return ( offset >= length ); }
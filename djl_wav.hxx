@@ -1,6 +1,11 @@
 #pragma once
 
 // Minimally parse and read uncompressed WAV files. Only supports formats I could test.
+// RF64/BW64 (RIFF with a ds64 chunk for 64-bit sizes) and Sony Wave64 files are read too.
+// Sample data read from files is memory mapped read-only rather than loaded, so large files cost address
+// space, not memory. Edits like Normalize() first copy the data into memory; the file is never modified.
+// A DjlParseWav can also view a ring holding the most recent samples of a live stream (see djl_wavpipe.hxx).
+// Pack() replaces the data with a lossless compressed copy (see djl_packed.hxx) when it won't fit in RAM.
 // WAV file writing support is started but far from complete.
 
 #include <dshow.h>
@@ -12,6 +17,7 @@
 #include <assert.h>
 #include <djltrace.hxx>
 #include <djl_strm.hxx>
+#include <djl_packed.hxx>
 
 class DjlParseWav
 {
@@ -65,6 +71,20 @@ class DjlParseWav
                 }
             };
 
+            struct WavDs64chunk : WavChunkHeader
+            {
+                unsigned __int64 riffSize;    // used in place of WavHeader::size when that's 0xffffffff
+                unsigned __int64 dataSize;    // used in place of the data chunk's formatSize when that's 0xffffffff
+                unsigned __int64 sampleCount;
+                DWORD tableLength;            // count of entries for other chunks > 4GB; ignored
+            };
+
+            struct W64ChunkHeader
+            {
+                byte guid[ 16 ];              // chunks are GUIDs whose first 4 bytes are the usual FOURCC
+                unsigned __int64 size;        // includes this header. Chunks are 8-byte aligned
+            };
+
             struct WavInfochunk : WavChunkHeader
             {
                 // ISFT == Name of the software package used to create the file
@@ -85,6 +105,12 @@ class DjlParseWav
         DjlParseWav( WCHAR const * pwcFile ) :
             stream( pwcFile ),
             successfulParse( false ),
+            pbData( 0 ),
+            hMapping( 0 ),
+            pView( 0 ),
+            ringFrames( 0 ),
+            ringValidFrames( 0 ),
+            packedKind( 0 ),
             samples( 0 ),
             bytesPS( 0 ),
             sampleRate( 0.0 ),
@@ -101,6 +127,12 @@ class DjlParseWav
         DjlParseWav( WCHAR const * pwcFile, WavSubchunk & wavsub ) :
             stream( pwcFile, true ),
             successfulParse( false ),
+            pbData( 0 ),
+            hMapping( 0 ),
+            pView( 0 ),
+            ringFrames( 0 ),
+            ringValidFrames( 0 ),
+            packedKind( 0 ),
             samples( 0 ),
             bytesPS( 0 ),
             sampleRate( 0.0 ),
@@ -131,7 +163,13 @@ class DjlParseWav
             forWrite( false ),
             sampleRate( 0.0 ),
             samples( 0 ),
-            successfulParse( false )
+            successfulParse( false ),
+            pbData( 0 ),
+            hMapping( 0 ),
+            pView( 0 ),
+            ringFrames( 0 ),
+            ringValidFrames( 0 ),
+            packedKind( 0 )
         {
             // wf may actually be a WAVEFORMATEXTENSIBLE, and that's fine.
 
@@ -143,21 +181,60 @@ class DjlParseWav
 
             successfulParse = true;
             memcpy( &fmtSubchunk.formatType, wf, sizeof WAVEFORMATEX + wf->cbSize );
-            samples = (DWORD) ( size / ( fmtSubchunk.bitsPerSample / 8 ) / fmtSubchunk.channels );
+            samples = (unsigned __int64) ( size / ( fmtSubchunk.bitsPerSample / 8 ) / fmtSubchunk.channels );
             sampleRate = (double) fmtSubchunk.sampleRate;
             bytesPS = fmtSubchunk.bitsPerSample / 8;
             fmtType = fmtSubchunk.formatType;
 
             data.reset( new byte[ size ] );
             memcpy( data.get(), buffer, size );
+            pbData = data.get();
+        } //DjlParseWav
+
+        // View a ring of the most recent frames of a live stream. Sample s lives at frame s % frames.
+        // Samples() is whatever the owner last passed to SetStreamSamples(); only the newest validFrames are
+        // valid. The rest of the ring is headroom the writer may be filling while samples are read.
+
+        DjlParseWav( const WavSubchunk & wavsub, byte * ring, unsigned __int64 frames, unsigned __int64 validFrames ) :
+            successfulParse( false ),
+            pbData( ring ),
+            hMapping( 0 ),
+            pView( 0 ),
+            ringFrames( frames ),
+            ringValidFrames( validFrames ),
+            packedKind( 0 ),
+            samples( 0 ),
+            bytesPS( 0 ),
+            sampleRate( 0.0 ),
+            forWrite( false ),
+            fmtType( 0 )
+        {
+            fmtSubchunk = wavsub;
+            fmtType = fmtSubchunk.formatType;
+            sampleRate = (double) fmtSubchunk.sampleRate;
+            successfulParse = ( 0 != validFrames ) && ( validFrames <= frames ) && validateFormat();
         } //DjlParseWav
 
+        ~DjlParseWav()
+        {
+            if ( 0 != pView )
+                UnmapViewOfFile( pView );
+
+            if ( 0 != hMapping )
+                CloseHandle( hMapping );
+        } //~DjlParseWav
+
         bool SuccessfulParse() { return successfulParse; }
         bool OpenSuccessful() { return SuccessfulParse() || stream.Ok(); }
         WavSubchunk & GetFmt() { return fmtSubchunk; }
-        const byte * GetData() { return data.get(); }
-        DWORD Samples() { return samples; }
+        const byte * GetData() { return pbData; }
+        unsigned __int64 Samples() { return samples; }
+        bool IsStream() { return ( 0 != ringFrames ); }
+        void SetStreamSamples( unsigned __int64 s ) { assert( IsStream() ); samples = s; }
+        unsigned __int64 FirstValidSample() { return ( samples > ringValidFrames && IsStream() ) ? samples - ringValidFrames : 0; }
         WORD Channels() { return fmtSubchunk.channels; }
+        bool IsPacked() { return ( 0 != packed.get() ); }
+        unsigned __int64 PackedBytes() { return IsPacked() ? packed->CompressedBytes() : 0; }
         double SecondsOfSound() { return (double) samples / sampleRate; }
 
         const WCHAR * GetFormatType()
@@ -176,7 +253,7 @@ class DjlParseWav
             return L"unknown";
         } //GetFormatType
 
-        void GetSample( DWORD s, double & left, double & right )
+        void GetSample( unsigned __int64 s, double & left, double & right )
         {
             assert( s < samples );
             assert( fmtSubchunk.channels > 1 );
@@ -190,7 +267,7 @@ class DjlParseWav
             assert( right <= 1.0 );
         } //GetSample
 
-        double GetSampleLeft( DWORD s )
+        double GetSampleLeft( unsigned __int64 s )
         {
             assert( s < samples );
 
@@ -200,7 +277,7 @@ class DjlParseWav
             return left;
         } //GetSample
 
-        double GetSampleInChannel( DWORD s, DWORD channel )
+        double GetSampleInChannel( unsigned __int64 s, DWORD channel )
         {
             assert( s < samples );
             assert( channel < fmtSubchunk.channels );
@@ -211,7 +288,7 @@ class DjlParseWav
             return left;
         } //GetSampleInChannel
 
-        double GetSampleRight( DWORD s )
+        double GetSampleRight( unsigned __int64 s )
         {
             assert( s < samples );
             assert( fmtSubchunk.channels > 1 );
@@ -288,11 +365,14 @@ class DjlParseWav
             }
         } //WriteSample
 
-        void OverwriteSample( int index, double v, DWORD channel )
+        void OverwriteSample( unsigned __int64 index, double v, DWORD channel )
         {
+            if ( !makeWritable() )
+                return;
+
             DWORD chOffset = channel * bytesPS;
-            DWORD offset = chOffset + ( index * fmtSubchunk.blockAlign );
-            byte *pdata = data.get() + offset;
+            unsigned __int64 offset = chOffset + ( index * fmtSubchunk.blockAlign );
+            byte *pdata = pbData + offset;
 
             if ( 1 == bytesPS && 1 == fmtType )
             {
@@ -336,8 +416,8 @@ class DjlParseWav
 
             // map the range 0 to TwoPI to the # of samples to get a sample index
 
-            DWORD usedSamples = __min( maxSamples, samples );
-            DWORD index = (DWORD) ( s / TwoPI * (double) usedSamples );
+            unsigned __int64 usedSamples = __min( (unsigned __int64) maxSamples, samples );
+            unsigned __int64 index = (unsigned __int64) ( s / TwoPI * (double) usedSamples );
 
             assert( index < samples );
 
@@ -352,7 +432,7 @@ class DjlParseWav
         {
             assert( successfulParse );
             assert( channel < fmtSubchunk.channels );
-            DWORD index = (DWORD) ( noteTime * sampleRate * noteMultiplier );
+            unsigned __int64 index = (unsigned __int64) ( noteTime * sampleRate * noteMultiplier );
 
             // it's not a bug -- it's if we're past the end of the waveform
 
@@ -371,6 +451,113 @@ class DjlParseWav
             return d;
         } //Wave
 
+        // Compress the sample data into memory and release the original. Reads every sample once.
+        // Afterwards samples are read-only; edits like Normalize() do nothing.
+
+        bool Pack()
+        {
+            if ( !successfulParse || IsStream() || forWrite || 0 == samples )
+                return false;
+
+            if ( IsPacked() )
+                return true;
+
+            // each sample becomes the int32 that GetChannel() can map back to the same value.
+            // Doubles become two int32s, stored as adjacent channels
+
+            if ( 1 == fmtType && bytesPS >= 1 && bytesPS <= 3 )
+                packedKind = bytesPS;
+            else if ( 1 == fmtType && 4 == bytesPS )
+                packedKind = PackedPCM32;
+            else if ( ( 6 == fmtType || 7 == fmtType ) && 1 == bytesPS )
+                packedKind = fmtType;
+            else if ( 3 == fmtType && 4 == bytesPS )
+                packedKind = PackedFloat;
+            else if ( 0xfffe == fmtType && 4 == bytesPS && MEDIASUBTYPE_IEEE_FLOAT == fmtSubchunk.subFormat )
+                packedKind = PackedFloat;
+            else if ( 0xfffe == fmtType && 8 == bytesPS && MEDIASUBTYPE_IEEE_FLOAT == fmtSubchunk.subFormat )
+                packedKind = PackedDouble;
+            else if ( 0xfffe == fmtType && 4 == bytesPS && MEDIASUBTYPE_PCM == fmtSubchunk.subFormat )
+                packedKind = PackedPCM32;
+            else
+            {
+                tracer.Trace( "can't pack format %d with %d bytes per sample\n", fmtType, bytesPS );
+                return false;
+            }
+
+            const byte * pb = pbData;
+            const DWORD align = fmtSubchunk.blockAlign;
+            const int bps = bytesPS;
+            const int kind = packedKind;
+            const uint32_t packedChannels = fmtSubchunk.channels * ( ( PackedDouble == kind ) ? 2 : 1 );
+
+            unique_ptr<CPackedSamples> p( new CPackedSamples() );
+            bool ok = p->Build( packedChannels, samples, [pb, align, bps, kind] ( uint64_t first, uint32_t count, int32_t * pdata, uint32_t stride )
+            {
+                for ( uint32_t i = 0; i < count; i++ )
+                {
+                    const byte * ps = pb + ( first + i ) * align;
+
+                    for ( uint32_t c = 0; c < stride; c++, ps += bps )
+                    {
+                        int32_t v;
+
+                        if ( PackedDouble == kind )
+                        {
+                            // like floats, but the ordered 64 bits are split into high and low channels
+
+                            uint64_t u;
+                            memcpy( &u, ps, sizeof u );
+                            u ^= (uint64_t) ( (int64_t) u >> 63 ) & 0x7fffffffffffffff;
+                            pdata[ (size_t) i * stride + c ] = (int32_t) ( u >> 32 );
+                            pdata[ (size_t) i * stride + c + 1 ] = (int32_t) u;
+                            c++;
+                            continue;
+                        }
+
+                        if ( 1 == kind )
+                            v = (int32_t) (char) ps[ 0 ];
+                        else if ( 2 == kind )
+                            v = (int32_t) (short) ( ps[ 0 ] | ( ps[ 1 ] << 8 ) );
+                        else if ( 3 == kind )
+                            v = ( (int32_t) ( ( (uint32_t) ps[ 0 ] << 8 ) | ( (uint32_t) ps[ 1 ] << 16 ) | ( (uint32_t) ps[ 2 ] << 24 ) ) ) >> 8;
+                        else if ( PackedFloat == kind )
+                        {
+                            // flip the magnitude of negative floats so nearby values are nearby integers
+
+                            memcpy( &v, ps, sizeof v );
+                            v ^= ( v >> 31 ) & 0x7fffffff;
+                        }
+                        else if ( PackedPCM32 == kind )
+                            memcpy( &v, ps, sizeof v );
+                        else
+                            v = ps[ 0 ];
+
+                        pdata[ (size_t) i * stride + c ] = v;
+                    }
+                }
+            } );
+
+            if ( !ok )
+                return false;
+
+            tracer.Trace( "packed %llu bytes of samples into %llu\n", samples * align, p->CompressedBytes() );
+
+            packed = move( p );
+            data.reset();
+            pbData = 0;
+
+            if ( 0 != pView )
+            {
+                UnmapViewOfFile( pView );
+                CloseHandle( hMapping );
+                pView = 0;
+                hMapping = 0;
+            }
+
+            return true;
+        } //Pack
+
         void Normalize( double amount = 0.70794578 )
         {
             if ( 0 == samples )
@@ -383,7 +570,7 @@ class DjlParseWav
 
             double maxSample = 0.0;
 
-            for ( DWORD s = 0; s < samples; s++ )
+            for ( unsigned __int64 s = 0; s < samples; s++ )
             {
                 for ( int c = 0; c < fmtSubchunk.channels; c++ )
                 {
@@ -395,7 +582,7 @@ class DjlParseWav
 
             double factor = amount / maxSample;
 
-            for ( DWORD s = 0; s < samples; s++ )
+            for ( unsigned __int64 s = 0; s < samples; s++ )
             {
                 for ( int c = 0; c < fmtSubchunk.channels; c++ )
                 {
@@ -410,8 +597,8 @@ class DjlParseWav
             if ( 0 == samples )
                 return;
 
-            DWORD top = 0;
-            DWORD bottom = samples - 1;
+            unsigned __int64 top = 0;
+            unsigned __int64 bottom = samples - 1;
 
             while ( top < bottom )
             {
@@ -433,14 +620,64 @@ class DjlParseWav
 
         CStream stream;
         bool successfulParse;
-        unique_ptr<byte> data;
+        unique_ptr<byte[]> data;      // sample data when it's not mapped
+        byte * pbData;                // sample data, either data or within pView
+        HANDLE hMapping;
+        byte * pView;
+        unsigned __int64 ringFrames;  // non-zero when pbData is a ring for a live stream
+        unsigned __int64 ringValidFrames;   // the newest frames in the ring that readers may use
+        unique_ptr<CPackedSamples> packed;   // replaces pbData once Pack() succeeds
+        int packedKind;               // bytes per sample for 8/16/24-bit PCM, else fmtType or a Packed* value
         WavSubchunk fmtSubchunk;
-        DWORD samples;
+        unsigned __int64 samples;
         int bytesPS;
         double sampleRate;
         bool forWrite;
         WORD fmtType;
 
+        static const int PackedFloat = 0x100;
+        static const int PackedPCM32 = 0x101;
+        static const int PackedDouble = 0x102;
+
+        double GetPackedChannel( unsigned __int64 index, int channel )
+        {
+            if ( PackedDouble == packedKind )
+            {
+                uint64_t u = ( (uint64_t) (uint32_t) packed->Get( index, 2 * channel ) << 32 ) |
+                             (uint32_t) packed->Get( index, 2 * channel + 1 );
+                u ^= (uint64_t) ( (int64_t) u >> 63 ) & 0x7fffffffffffffff;
+                double d;
+                memcpy( &d, &u, sizeof d );
+                return d;
+            }
+
+            int32_t v = packed->Get( index, channel );
+
+            if ( 1 == packedKind )
+                return (double) v / (double) 128;
+            if ( 2 == packedKind )
+                return (double) v / (double) 32768;
+            if ( 3 == packedKind )
+                return (double) v / (double) ( 1 << 23 );
+            if ( 6 == packedKind )
+                return (double) ALawDecompressTable[ v ] / 32768.0;
+            if ( 7 == packedKind )
+                return (double) MuLawDecompressTable[ v ] / 32768.0;
+            if ( PackedPCM32 == packedKind )
+                return (double) v / (double) (long) 0x7fffffff;
+
+            float f;
+            v ^= ( v >> 31 ) & 0x7fffffff;
+            memcpy( &f, &v, sizeof f );
+
+            if ( f > 1.0 )
+                f = 1.0;
+            else if ( f < -1.0 )
+                f = -1.0;
+
+            return (double) f;
+        } //GetPackedChannel
+
         void TraceGuid( GUID & guid )
         {
             tracer.TraceQuiet( "Guid = {%08lX-%04hX-%04hX-%02hhX%02hhX-%02hhX%02hhX%02hhX%02hhX%02hhX%02hhX}",
@@ -449,6 +686,227 @@ class DjlParseWav
                                guid.Data4[4], guid.Data4[5], guid.Data4[6], guid.Data4[7] );
         } //TraceGuid
 
+        bool validateFormat()
+        {
+            if ( 0xfffe == fmtType )
+            {
+                tracer.Trace( "extensible format; " );
+                TraceGuid( fmtSubchunk.subFormat );
+                tracer.TraceQuiet( "\n" );
+
+                #if false
+                MEDIASUBTYPE_PCM
+                MEDIASUBTYPE_IEEE_FLOAT
+                MEDIASUBTYPE_PCM_FL64
+                MEDIASUBTYPE_PCM_FL64_le
+                MEDIASUBTYPE_PCM_FL32
+                MEDIASUBTYPE_PCM_FL32_le
+                MEDIASUBTYPE_PCM_IN32
+                MEDIASUBTYPE_PCM_IN32_le
+                MEDIASUBTYPE_PCM_IN24
+                MEDIASUBTYPE_PCM_IN24_le
+                MFAudioFormat_PCM_HDCP
+                #endif                               
+            }
+
+            if ( 1 != fmtType && 3 != fmtType && 6 != fmtType && 7 != fmtType && 0xfffe != fmtType )
+            {
+                tracer.Trace( "format type %#x isn't supported 1/3/6/7/Ext are supported)\n", fmtType );
+                return false;
+            }
+
+            int bps = fmtSubchunk.bitsPerSample;
+
+            if ( ( 0 == fmtSubchunk.channels ) ||
+                 ( 0 == fmtSubchunk.dataRate ) ||
+                 ( 8 != bps && 16 != bps && 24 != bps && 32 != bps && 64 != bps ) )
+            {
+                tracer.Trace( "unsupported channels %d, datarate %d, or bits per sample %d\n", fmtSubchunk.channels, fmtSubchunk.dataRate, bps );
+                return false;
+            }
+
+            bytesPS = bps / 8;
+            int bytesPerSample =  fmtSubchunk.channels * ( fmtSubchunk.bitsPerSample / 8 );
+
+            if ( bytesPerSample > fmtSubchunk.blockAlign )
+            {
+                tracer.Trace( "bytes per sample (%d) > block align (%d); malformed WAV file\n", bytesPerSample, fmtSubchunk.blockAlign );
+                return false;
+            }
+
+            return true;
+        } //validateFormat
+
+        // Validate the format now that the data chunk is found, then map or read the sample data
+
+        bool loadData( CStream & stream, __int64 dataOffset, unsigned __int64 dataSize )
+        {
+            if ( !validateFormat() )
+                return false;
+
+            samples = dataSize / fmtSubchunk.blockAlign;
+
+            if ( (unsigned __int64) stream.Length() < ( dataOffset + dataSize ) )
+            {
+                tracer.Trace( "stream length %lld isn't long enough for implied size %llu\n", stream.Length(), dataOffset + dataSize );
+                return false;
+            }
+
+            //printf( "seconds of sound: %lf\n", (double) samples / sampleRate );
+
+            if ( dataSize > (size_t) -1 )
+            {
+                tracer.Trace( "data size %llu is too large for this process\n", dataSize );
+                return false;
+            }
+
+            // Views must start on an allocation granularity boundary
+
+            SYSTEM_INFO si;
+            GetSystemInfo( &si );
+            __int64 mapOffset = dataOffset - ( dataOffset % si.dwAllocationGranularity );
+
+            // A copy-on-write view would be charged against commit for its full size, so map read-only
+
+            hMapping = CreateFileMapping( stream.Handle(), NULL, PAGE_READONLY, 0, 0, NULL );
+            if ( 0 != hMapping )
+                pView = (byte *) MapViewOfFile( hMapping, FILE_MAP_READ, (DWORD) ( mapOffset >> 32 ), (DWORD) mapOffset,
+                                                (SIZE_T) ( dataOffset - mapOffset + dataSize ) );
+
+            if ( 0 != pView )
+            {
+                pbData = pView + ( dataOffset - mapOffset );
+                return true;
+            }
+
+            tracer.Trace( "can't map wav data, error %d; reading it instead\n", GetLastError() );
+
+            if ( 0 != hMapping )
+            {
+                CloseHandle( hMapping );
+                hMapping = 0;
+            }
+
+            data.reset( new ( std::nothrow ) byte[ (size_t) dataSize ] );
+            pbData = data.get();
+            if ( 0 == pbData )
+            {
+                tracer.Trace( "can't allocate %llu bytes for wav data\n", dataSize );
+                return false;
+            }
+
+            // CStream reads are limited to 32 bits
+
+            const unsigned __int64 maxRead = 1024 * 1024 * 1024;
+            stream.Seek( dataOffset );
+
+            for ( unsigned __int64 done = 0; done < dataSize; )
+            {
+                ULONG cb = (ULONG) __min( maxRead, dataSize - done );
+                if ( cb != stream.Read( pbData + done, cb ) )
+                {
+                    tracer.Trace( "can't read wav data at offset %llu\n", done );
+                    return false;
+                }
+                done += cb;
+            }
+
+            return true;
+        } //loadData
+
+        static bool sameW64Guid( const byte * guid, const char * fourcc, bool riff )
+        {
+            // riff uses a different GUID suffix than wave, fmt, data, and the rest
+
+            static const byte riffSuffix[ 12 ] = { 0x2e, 0x91, 0xcf, 0x11, 0xa5, 0xd6, 0x28, 0xdb, 0x04, 0xc1, 0x00, 0x00 };
+            static const byte otherSuffix[ 12 ] = { 0xf3, 0xac, 0xd3, 0x11, 0x8c, 0xd1, 0x00, 0xc0, 0x4f, 0x8e, 0xdb, 0x8a };
+
+            return ( !memcmp( guid, fourcc, 4 ) && !memcmp( guid + 4, riff ? riffSuffix : otherSuffix, 12 ) );
+        } //sameW64Guid
+
+        bool parseW64Stream( CStream & stream )
+        {
+            __int64 len = stream.Length();
+            W64ChunkHeader header;
+            byte waveGuid[ 16 ];
+
+            if ( len < sizeof header + sizeof waveGuid )
+            {
+                tracer.Trace( "W64 file is too small\n" );
+                return false;
+            }
+
+            stream.GetBytes( 0, &header, sizeof header );
+            stream.GetBytes( sizeof header, waveGuid, sizeof waveGuid );
+
+            if ( !sameW64Guid( header.guid, "riff", true ) || !sameW64Guid( waveGuid, "wave", false ) )
+            {
+                tracer.Trace( "W64 header isn't riff/wave\n" );
+                return false;
+            }
+
+            __int64 offset = sizeof header + sizeof waveGuid;
+
+            while ( ( offset + (__int64) sizeof header ) <= len )
+            {
+                W64ChunkHeader chunk;
+                stream.GetBytes( offset, &chunk, sizeof chunk );
+
+                if ( chunk.size < sizeof chunk )
+                {
+                    tracer.Trace( "W64 chunk at offset %lld has invalid size %llu\n", offset, chunk.size );
+                    return false;
+                }
+
+                unsigned __int64 bodySize = chunk.size - sizeof chunk;
+
+                if ( sameW64Guid( chunk.guid, "fmt ", false ) )
+                {
+                    // reuse the RIFF struct; its 8-byte chunk header isn't part of the W64 body
+
+                    WavSubchunk fmt;
+                    const size_t fmtBody = sizeof fmt - sizeof WavChunkHeader;
+                    stream.GetBytes( offset + sizeof chunk, &fmt.formatType, (int) __min( (unsigned __int64) fmtBody, bodySize ) );
+                    fmtSubchunk = fmt;
+                    fmtType = fmtSubchunk.formatType;
+                    sampleRate = (double) fmtSubchunk.sampleRate;
+                }
+                else if ( sameW64Guid( chunk.guid, "data", false ) )
+                    return loadData( stream, offset + sizeof chunk, bodySize );
+
+                offset += (__int64) round_up( chunk.size, (unsigned __int64) 8 );
+            }
+
+            return false;
+        } //parseW64Stream
+
+        // Mapped views are read-only. Copy the data into memory before the first edit
+
+        bool makeWritable()
+        {
+            if ( IsStream() || IsPacked() )
+                return false;
+
+            if ( 0 == pView )
+                return true;
+
+            size_t size = (size_t) ( samples * fmtSubchunk.blockAlign );
+            data.reset( new ( std::nothrow ) byte[ size ] );
+            if ( 0 == data.get() )
+            {
+                tracer.Trace( "can't allocate %zd bytes to make wav data writable\n", size );
+                return false;
+            }
+
+            memcpy( data.get(), pbData, size );
+            pbData = data.get();
+            UnmapViewOfFile( pView );
+            CloseHandle( hMapping );
+            pView = 0;
+            hMapping = 0;
+            return true;
+        } //makeWritable
+
         bool parseStream( CStream & stream )
         {
             WavHeader header;
@@ -461,10 +919,17 @@ class DjlParseWav
             }
         
             stream.GetBytes( 0, &header, sizeof header );
+
+            if ( !memcmp( & header.riff, "riff", sizeof header.riff ) )
+                return parseW64Stream( stream );
+
+            // RF64 and BW64 are RIFF with a ds64 chunk holding sizes that don't fit in 32 bits
+
+            bool rf64 = ( !memcmp( & header.riff, "RF64", sizeof header.riff ) || !memcmp( & header.riff, "BW64", sizeof header.riff ) );
         
-            if ( memcmp( & header.riff, "RIFF", sizeof header.riff ) )
+            if ( !rf64 && memcmp( & header.riff, "RIFF", sizeof header.riff ) )
             {
-                tracer.Trace( "Wav header isn't RIFF\n" );
+                tracer.Trace( "Wav header isn't RIFF, RF64, BW64, or W64\n" );
                 return false;
             }
         
@@ -475,6 +940,7 @@ class DjlParseWav
             }
 
             __int64 offset = sizeof header;
+            unsigned __int64 ds64DataSize = 0;
         
             while ( offset < len )
             {
@@ -498,68 +964,29 @@ class DjlParseWav
                     fmtType = fmtSubchunk.formatType;
                     sampleRate = (double) chunk.sampleRate;
                 }
+                else if ( !memcmp( &chunk.format, "ds64", 4 ) )
+                {
+                    WavDs64chunk ds64;
+                    stream.GetBytes( offset, &ds64, sizeof ds64 );
+                    ds64DataSize = ds64.dataSize;
+                    tracer.Trace( "ds64 riff size %llu, data size %llu, sample count %llu\n", ds64.riffSize, ds64.dataSize, ds64.sampleCount );
+                }
                 else if ( !memcmp( &chunk.format, "data", 4 ) )
                 {
-                    if ( 0xfffe == fmtType )
-                    {
-                        tracer.Trace( "extensible format; " );
-                        TraceGuid( fmtSubchunk.subFormat );
-                        tracer.TraceQuiet( "\n" );
-
-                        #if false
-                        MEDIASUBTYPE_PCM
-                        MEDIASUBTYPE_IEEE_FLOAT
-                        MEDIASUBTYPE_PCM_FL64
-                        MEDIASUBTYPE_PCM_FL64_le
-                        MEDIASUBTYPE_PCM_FL32
-                        MEDIASUBTYPE_PCM_FL32_le
-                        MEDIASUBTYPE_PCM_IN32
-                        MEDIASUBTYPE_PCM_IN32_le
-                        MEDIASUBTYPE_PCM_IN24
-                        MEDIASUBTYPE_PCM_IN24_le
-                        MFAudioFormat_PCM_HDCP
-                        #endif                               
-                    }
+                    unsigned __int64 dataSize = chunk.formatSize;
 
-                    if ( 1 != fmtType && 3 != fmtType && 6 != fmtType && 7 != fmtType && 0xfffe != fmtType )
+                    if ( rf64 && 0xffffffff == chunk.formatSize )
                     {
-                        tracer.Trace( "format type %#x isn't supported 1/3/6/7/Ext are supported)\n", fmtType );
-                        return false;
-                    }
-
-                    int bps = fmtSubchunk.bitsPerSample;
+                        if ( 0 == ds64DataSize )
+                        {
+                            tracer.Trace( "RF64 file has no ds64 chunk before the data chunk\n" );
+                            return false;
+                        }
 
-                    if ( ( 0 == fmtSubchunk.channels ) ||
-                         ( 0 == fmtSubchunk.dataRate ) ||
-                         ( 8 != bps && 16 != bps && 24 != bps && 32 != bps && 64 != bps ) )
-                    {
-                        tracer.Trace( "unsupported channels %d, datarate %d, or bits per sample %d\n", fmtSubchunk.channels, fmtSubchunk.dataRate, bps );
-                        return false;
+                        dataSize = ds64DataSize;
                     }
 
-                    bytesPS = bps / 8;
-                    int bytesPerSample =  fmtSubchunk.channels * ( fmtSubchunk.bitsPerSample / 8 );
-
-                    if ( bytesPerSample > fmtSubchunk.blockAlign )
-                    {
-                        tracer.Trace( "bytes per sample (%d) > block align (%d); malformed WAV file\n", bytesPerSample, fmtSubchunk.blockAlign );
-                        return false;
-                    }
-
-                    samples = chunk.formatSize / fmtSubchunk.blockAlign;
-
-                    if ( stream.Length() < ( offset + 8 + chunk.formatSize ) )
-                    {
-                        tracer.Trace( "stream length %lld isn't long enough for implied size %d\n", stream.Length(), ( offset + 8 + chunk.formatSize ) );
-                        return false;
-                    }
-
-                    //printf( "seconds of sound: %lf\n", (double) samples / sampleRate );
-
-                    data.reset( new byte[ chunk.formatSize ] );
-                    stream.GetBytes( offset + 8, data.get(), chunk.formatSize );
-        
-                    return true; // don't worry about later chunks
+                    return loadData( stream, offset + 8, dataSize ); // don't worry about later chunks
                 }
         
                 offset += ( (__int64) chunk.formatSize + (__int64) 8 );
@@ -568,7 +995,7 @@ class DjlParseWav
             return false;
         } //parseStream
 
-        double GetExtendedChannel( DWORD offset )
+        double GetExtendedChannel( unsigned __int64 offset )
         {
             if ( 0xfffe != fmtType )
                 return 0.0;
@@ -579,14 +1006,14 @@ class DjlParseWav
                 {
                     assert( 8 == sizeof( double ) );
                     double d;
-                    memcpy( &d, data.get() + offset, sizeof d );
+                    memcpy( &d, pbData + offset, sizeof d );
                     return d;
                 }
                 else if ( 4 == bytesPS )
                 {
                     assert( 4 == sizeof( float ) );
                     float f;
-                    memcpy( &f, data.get() + offset, sizeof f );
+                    memcpy( &f, pbData + offset, sizeof f );
 
                     // WAV files created with Scarlett hardware and Windows APIs result in slightly out of bounds values
 
@@ -606,7 +1033,7 @@ class DjlParseWav
                 if ( 4 == bytesPS )
                 {
                     long l;
-                    memcpy( &l, data.get() + offset, sizeof l );
+                    memcpy( &l, pbData + offset, sizeof l );
                     return (double) l / (double) (long) 0x7fffffff;
                 }
                 else
@@ -616,16 +1043,21 @@ class DjlParseWav
             return 0.0;
         } //GetExtendedChannel
 
-        __forceinline double GetChannel( DWORD index, int channel )
+        __forceinline double GetChannel( unsigned __int64 index, int channel )
         {
             assert( index < samples );
 
+            if ( 0 != ringFrames )
+                index %= ringFrames;
+            else if ( 0 != packed.get() )
+                return GetPackedChannel( index, channel );
+
             DWORD chOffset = channel * bytesPS;
-            DWORD offset = chOffset + ( index * fmtSubchunk.blockAlign );
+            unsigned __int64 offset = chOffset + ( index * fmtSubchunk.blockAlign );
 
             if ( 2 == bytesPS && 1 == fmtType )
             {
-                byte *p = data.get() + offset;
+                byte *p = pbData + offset;
                 int32_t v = *p | ( *(p+1) << 8 );
 
                 // sign extend from 16 bits to 32 bits
@@ -642,7 +1074,7 @@ class DjlParseWav
 
             if ( 3 == bytesPS && 1 == fmtType )
             {
-                byte *p = data.get() + offset;
+                byte *p = pbData + offset;
                 int32_t v = *p | ( *(p+1) << 8 ) | ( *(p+2) << 16 );
     
                 // sign extend from 24 bits to 32 bits
@@ -659,9 +1091,16 @@ class DjlParseWav
                 return (double) v / (double) denom;
             }
 
+            if ( 4 == bytesPS && 1 == fmtType )
+            {
+                int32_t v;
+                memcpy( &v, pbData + offset, sizeof v );
+                return (double) v / (double) 0x7fffffff;
+            }
+
             if ( 4 == bytesPS && 3 == fmtType )
             {
-                float f = * (float *) ( data.get() + offset );
+                float f = * (float *) ( pbData + offset );
                 //tracer.Trace( "float read from file: %f\n", f );
 
                 // some files have floats that are out of range
@@ -676,7 +1115,7 @@ class DjlParseWav
 
             if ( 1 == bytesPS && 1 == fmtType )
             {
-                int32_t v = (int) ( * (char *) ( data.get() + offset ) );
+                int32_t v = (int) ( * (char *) ( pbData + offset ) );
 
                 // sign extend from 8 bits to 32 bits
 
@@ -690,10 +1129,10 @@ class DjlParseWav
             }
 
             if ( 1 == bytesPS && 6 == fmtType )
-                return (double) ALawDecompressTable[ * ( data.get() + offset ) ] / 32768.0;
+                return (double) ALawDecompressTable[ * ( pbData + offset ) ] / 32768.0;
 
             if ( 1 == bytesPS && 7 == fmtType )
-                return (double) MuLawDecompressTable[ * ( data.get() + offset ) ] / 32768.0;
+                return (double) MuLawDecompressTable[ * ( pbData + offset ) ] / 32768.0;
 
             if ( 0xfffe == fmtType )
                 return GetExtendedChannel( offset );
@@ -0,0 +1,234 @@
+#pragma once
+
+//
+// Read a live stream of samples from a pipe (e.g. stdin) into a fixed-size ring holding the most recent
+// N seconds. The stream is either a WAV (RIFF, RF64, or BW64) whose sizes are ignored since they're usually
+// unknown when piped, or raw interleaved PCM / float whose format is supplied by the caller.
+// Raw 8-bit samples are unsigned, as capture tools write them, and are converted to the signed bytes
+// DjlParseWav reads.
+// Memory use is the ring plus nothing else no matter how long the stream runs.
+// The ring holds the requested seconds plus headroom for one read and one display tick, so frames that
+// readers consider valid aren't overwritten while they're read.
+// Wrap the ring with DjlParseWav( GetFmt(), Ring(), RingFrames(), ViewFrames() ) to read samples.
+//
+
+#include <atomic>
+#include <thread>
+#include <memory>
+#include <new>
+#include <djl_wav.hxx>
+
+class CWavPipe
+{
+    private:
+        HANDLE hInput;
+        DjlParseWav::WavSubchunk fmt;
+        unique_ptr<byte[]> ring;
+        unsigned __int64 ringFrames;
+        unsigned __int64 viewFrames;   // ringFrames less the headroom
+        DWORD maxRead;                 // bytes per ReadFile; part of the headroom
+        atomic<unsigned __int64> bytesWritten;
+        atomic<bool> ended;
+        atomic<bool> stopping;
+        bool flipSign;                 // raw unsigned 8-bit samples are stored signed
+        thread reader;
+
+        bool ReadFully( void * pv, DWORD cb )
+        {
+            byte * pb = (byte *) pv;
+
+            while ( 0 != cb )
+            {
+                DWORD dwRead = 0;
+                if ( !ReadFile( hInput, pb, cb, &dwRead, NULL ) || 0 == dwRead )
+                    return false;
+
+                pb += dwRead;
+                cb -= dwRead;
+            }
+
+            return true;
+        } //ReadFully
+
+        bool Skip( unsigned __int64 cb )
+        {
+            byte buf[ 4096 ];
+
+            while ( 0 != cb )
+            {
+                DWORD chunk = (DWORD) __min( cb, (unsigned __int64) sizeof buf );
+                if ( !ReadFully( buf, chunk ) )
+                    return false;
+                cb -= chunk;
+            }
+
+            return true;
+        } //Skip
+
+        bool ParseHeader()
+        {
+            DjlParseWav::WavHeader header;
+            if ( !ReadFully( &header, sizeof header ) )
+            {
+                tracer.Trace( "can't read the wav header from the stream\n" );
+                return false;
+            }
+
+            if ( ( memcmp( &header.riff, "RIFF", 4 ) && memcmp( &header.riff, "RF64", 4 ) && memcmp( &header.riff, "BW64", 4 ) ) ||
+                 memcmp( &header.wave, "WAVE", 4 ) )
+            {
+                tracer.Trace( "stream isn't RIFF, RF64, or BW64 WAVE. Specify the format for raw streams\n" );
+                return false;
+            }
+
+            bool fmtFound = false;
+
+            do
+            {
+                DjlParseWav::WavChunkHeader chunk;
+                if ( !ReadFully( &chunk, sizeof chunk ) )
+                {
+                    tracer.Trace( "stream ended before the data chunk\n" );
+                    return false;
+                }
+
+                // chunks are word aligned. data's size is ignored; it's usually 0 or 0xffffffff when streamed
+
+                if ( !memcmp( &chunk.format, "data", 4 ) )
+                    break;
+
+                unsigned __int64 size = chunk.formatSize + ( chunk.formatSize & 1 );
+
+                if ( !memcmp( &chunk.format, "fmt ", 4 ) )
+                {
+                    const DWORD fmtBody = sizeof fmt - sizeof DjlParseWav::WavChunkHeader;
+                    DWORD cb = (DWORD) __min( size, (unsigned __int64) fmtBody );
+                    fmt = DjlParseWav::WavSubchunk();
+                    fmt.format = chunk.format;
+                    fmt.formatSize = chunk.formatSize;
+                    if ( !ReadFully( &fmt.formatType, cb ) )
+                        return false;
+                    size -= cb;
+                    fmtFound = true;
+                }
+
+                if ( !Skip( size ) )
+                    return false;
+            } while ( true );
+
+            if ( !fmtFound )
+                tracer.Trace( "stream has no fmt chunk before data\n" );
+
+            return fmtFound;
+        } //ParseHeader
+
+        void ReaderThread()
+        {
+            const unsigned __int64 ringBytes = ringFrames * fmt.blockAlign;
+            unsigned __int64 written = 0;
+
+            while ( !stopping )
+            {
+                // read straight into the ring, never across its end
+
+                size_t pos = (size_t) ( written % ringBytes );
+                DWORD cb = (DWORD) __min( ringBytes - pos, (unsigned __int64) maxRead );
+                DWORD dwRead = 0;
+
+                if ( !ReadFile( hInput, ring.get() + pos, cb, &dwRead, NULL ) || 0 == dwRead )
+                    break;
+
+                if ( flipSign )
+                    for ( DWORD i = 0; i < dwRead; i++ )
+                        ring[ pos + i ] ^= 0x80;
+
+                written += dwRead;
+                bytesWritten.store( written, memory_order_release );
+            }
+
+            tracer.Trace( "stream ended after %llu bytes, error %d\n", written, GetLastError() );
+            ended = true;
+        } //ReaderThread
+
+    public:
+        CWavPipe() : hInput( INVALID_HANDLE_VALUE ), ringFrames( 0 ), viewFrames( 0 ), maxRead( 0 ), bytesWritten( 0 ), ended( false ), stopping( false ), flipSign( false ) {}
+
+        ~CWavPipe()
+        {
+            Stop();
+        } //~CWavPipe
+
+        // Reads the WAV header (unless rawFmt is given) on this thread, then starts streaming on another.
+        // tickSeconds is the longest a reader may take between getting Frames() and finishing with them
+
+        bool Start( HANDLE h, double seconds, double tickSeconds, const DjlParseWav::WavSubchunk * rawFmt )
+        {
+            hInput = h;
+
+            if ( 0 != rawFmt )
+            {
+                fmt = *rawFmt;
+                flipSign = ( 8 == fmt.bitsPerSample && 1 == fmt.formatType );
+            }
+            else if ( !ParseHeader() )
+                return false;
+
+            if ( 0 == fmt.blockAlign || 0 == fmt.sampleRate )
+            {
+                tracer.Trace( "stream format has block align %d and sample rate %d\n", fmt.blockAlign, fmt.sampleRate );
+                return false;
+            }
+
+            viewFrames = (unsigned __int64) ceil( seconds * (double) fmt.sampleRate );
+            if ( viewFrames < 1 )
+                viewFrames = 1;
+
+            const DWORD MaxReadBytes = 64 * 1024;
+            unsigned __int64 readFrames = __max( (unsigned __int64) 1, (unsigned __int64) ( MaxReadBytes / fmt.blockAlign ) );
+            unsigned __int64 tickFrames = (unsigned __int64) ceil( tickSeconds * (double) fmt.sampleRate );
+            maxRead = (DWORD) ( readFrames * fmt.blockAlign );
+            ringFrames = viewFrames + readFrames + tickFrames;
+
+            // a long window of many channels can be more than memory or the address space allows
+
+            unsigned __int64 ringBytes = ringFrames * fmt.blockAlign;
+            if ( ringBytes > (unsigned __int64) SIZE_MAX )
+            {
+                tracer.Trace( "stream ring of %llu bytes is too large\n", ringBytes );
+                return false;
+            }
+
+            ring.reset( new ( std::nothrow ) byte[ (size_t) ringBytes ] );
+            if ( 0 == ring.get() )
+            {
+                tracer.Trace( "can't allocate %llu bytes for the stream ring\n", ringBytes );
+                return false;
+            }
+            reader = thread( &CWavPipe::ReaderThread, this );
+            return true;
+        } //Start
+
+        void Stop()
+        {
+            if ( reader.joinable() )
+            {
+                // the reader is probably blocked on the pipe. Cancel until it notices; it may not be in ReadFile yet
+
+                stopping = true;
+                while ( !ended )
+                {
+                    CancelSynchronousIo( reader.native_handle() );
+                    sleep_ms( 10 );
+                }
+
+                reader.join();
+            }
+        } //Stop
+
+        DjlParseWav::WavSubchunk & GetFmt() { return fmt; }
+        byte * Ring() { return ring.get(); }
+        unsigned __int64 RingFrames() { return ringFrames; }
+        unsigned __int64 ViewFrames() { return viewFrames; }
+        unsigned __int64 Frames() { return bytesWritten.load( memory_order_acquire ) / fmt.blockAlign; }
+        bool Ended() { return ended; }
+}; //CWavPipe
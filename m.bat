@@ -3,9 +3,12 @@ del osc.exe
 del osc.pdb
 del osc.res
 del osc.obj
+del oscbt.exe
+del oscbt.obj
 @echo on
 
 rc osc.rc
 cl /nologo osc.cxx /I.\ /DUNICODE /MT /Ox /Qpar /O2 /Oi /Ob2 /EHac /Zi /Gy /D_AMD64_ /link osc.res /OPT:REF /subsystem:windows
+cl /nologo oscbt.cxx /I.\ /DUNICODE /MT /Ox /Qpar /O2 /Oi /Ob2 /EHac /Zi /Gy /D_AMD64_ /link /OPT:REF
 
 
@@ -3,9 +3,12 @@ del osc.exe
 del osc.pdb
 del osc.res
 del osc.obj
+del oscbt.exe
+del oscbt.obj
 @echo on
 
 rc osc.rc
 cl /W4 /nologo osc.cxx /DNDEBUG /I.\ /DUNICODE /MT /Ox /Qpar /O2 /Oi /Ob2 /EHac /Zi /Gy /D_AMD64_ /link osc.res /OPT:REF /subsystem:windows
+cl /W4 /nologo oscbt.cxx /DNDEBUG /I.\ /DUNICODE /MT /Ox /Qpar /O2 /Oi /Ob2 /EHac /Zi /Gy /D_AMD64_ /link /OPT:REF
 
 
@@ -18,11 +18,15 @@ using namespace Gdiplus;
 using namespace concurrency;
 
 #include <djltrace.hxx>
+#include <djl_btrace.hxx>
 #include <djl_wav.hxx>
 #include <djlres.hxx>
 #include <djltimed.hxx>
 #include <djlsav.hxx>
 #include <djlenum.hxx>
+#include <djl_frame.hxx>
+#include <djl_filter.hxx>
+#include <djl_wavpipe.hxx>
 
 #include "osc.hxx"
 
@@ -37,18 +41,28 @@ using namespace concurrency;
 #define REGISTRY_WINDOW_POSITION L"WindowPosition"
 
 CDJLTrace tracer;
+CDJLBinaryTrace btracer;
 DjlParseWav * g_pwav = 0;
 double g_secondsOffset = 0;
 double g_wavSeconds = 0.0;
 double g_viewPeriod = 0.0;
 double g_amplitudeZoom = 1.0;
-DWORD g_wavSamples = 0;
+unsigned __int64 g_wavSamples = 0;
 int g_notePeriod = 'a';          // valid values: 'a'..'g'
 double g_currentPeriod = 440.0;  // maps to A above middle C
 HFONT g_fontText = 0;
 int g_fontHeight = 0;
 int g_borderSize = 0;
 bool g_createImages = false;
+CFilterChain g_filterChain;
+CFilterCache g_filterCache;
+bool g_filterEnabled = false;
+bool g_filterSuspended = false;
+bool g_packFailed = false;       // -c was given but the samples couldn't be compressed  // enabled, but the view is wider than the filter cache's budget
+CWavPipe * g_pipe = 0;           // non-zero when reading a live stream from stdin
+double g_streamSeconds = 10.0;   // length of the stream's ring
+int g_updatesPerSecond = 30;     // frame rate when streaming
+const UINT_PTR g_streamTimer = 1;
 const WCHAR * g_imagesFolder = L"osc_images";
 
 const int g_waveformWindowSize = 969; // nice. needs to be odd.
@@ -115,8 +129,13 @@ int WINAPI wWinMain( HINSTANCE hInstance, HINSTANCE, PWSTR pCmdLine, int nCmdSho
 
     bool enableTracer = false;
     bool emptyTracerFile = false;
+    bool enableBinaryTracer = false;
+    bool packSamples = false;
     bool readPosFromReg = true;
     static WCHAR awcInput[MAX_PATH] = {};
+    static char acFilter[ 100 ] = {};
+    bool rawStream = false;
+    DjlParseWav::WavSubchunk rawFmt;
 
     {
         int argc = 0;
@@ -127,7 +146,9 @@ int WINAPI wWinMain( HINSTANCE hInstance, HINSTANCE, PWSTR pCmdLine, int nCmdSho
             const WCHAR * pwcArg = argv[ i ];
             WCHAR a0 = pwcArg[ 0 ];
 
-            if ( ( L'-' == a0 ) || ( L'/' == a0 ) )
+            if ( !wcscmp( pwcArg, L"-" ) )
+                wcscpy_s( awcInput, _countof( awcInput ), pwcArg );
+            else if ( ( L'-' == a0 ) || ( L'/' == a0 ) )
             {
                WCHAR a1 = towlower( pwcArg[1] );
 
@@ -140,6 +161,10 @@ int WINAPI wWinMain( HINSTANCE hInstance, HINSTANCE, PWSTR pCmdLine, int nCmdSho
                }
                else if ( 'r' == a1 )
                    readPosFromReg = false;
+               else if ( 'b' == a1 )
+                   enableBinaryTracer = true;
+               else if ( 'c' == a1 )
+                   packSamples = true;
                else if ( 't' == pwcArg[1] )
                    enableTracer = true;
                else if ( 'T' == pwcArg[1] )
@@ -147,6 +172,16 @@ int WINAPI wWinMain( HINSTANCE hInstance, HINSTANCE, PWSTR pCmdLine, int nCmdSho
                    enableTracer = true;
                    emptyTracerFile = true;
                }
+               else if ( 'f' == a1 )
+               {
+                   if ( ':' != pwcArg[2] )
+                       return 0;
+
+                   if ( wcslen( pwcArg + 3 ) >= _countof( acFilter ) )
+                       return 0;
+
+                   wcstombs( acFilter, pwcArg + 3, _countof( acFilter ) );
+               }
                else if ( 'o' == a1 )
                {
                    if ( ':' != pwcArg[2] )
@@ -154,6 +189,43 @@ int WINAPI wWinMain( HINSTANCE hInstance, HINSTANCE, PWSTR pCmdLine, int nCmdSho
 
                    g_secondsOffset = fabs( wcstof( pwcArg + 3, NULL ) );
                }
+               else if ( 's' == a1 )
+               {
+                   if ( ':' != pwcArg[2] )
+                       return 0;
+
+                   g_streamSeconds = wcstod( pwcArg + 3, NULL );
+                   if ( g_streamSeconds <= 0.0 || g_streamSeconds > 3600.0 )
+                       return 0;
+               }
+               else if ( 'u' == a1 )
+               {
+                   if ( ':' != pwcArg[2] )
+                       return 0;
+
+                   g_updatesPerSecond = _wtoi( pwcArg + 3 );
+                   if ( g_updatesPerSecond < 1 || g_updatesPerSecond > 1000 )
+                       return 0;
+               }
+               else if ( 'w' == a1 )
+               {
+                   // raw stream format: rate,channels,bits[,f] where f means 32-bit float. 8-bit is unsigned
+
+                   if ( ':' != pwcArg[2] )
+                       return 0;
+
+                   unsigned int rate = 0, channels = 0, bits = 0;
+                   WCHAR type = 0;
+                   int fields = swscanf( pwcArg + 3, L"%u,%u,%u,%lc", &rate, &channels, &bits, &type );
+                   bool isFloat = ( 4 == fields && 'f' == towlower( type ) );
+
+                   if ( fields < 3 || 0 == rate || 0 == channels || channels > 0xffff ||
+                        ( 8 != bits && 16 != bits && 24 != bits && 32 != bits ) || ( isFloat && 32 != bits ) )
+                       return 0;
+
+                   rawFmt = DjlParseWav::WavSubchunk( isFloat ? 3 : 1, (WORD) channels, rate, (WORD) ( channels * bits / 8 ), (WORD) bits );
+                   rawStream = true;
+               }
                else if ( 'p' == a1 )
                {
                    if ( ':' != pwcArg[2] )
@@ -179,6 +251,7 @@ int WINAPI wWinMain( HINSTANCE hInstance, HINSTANCE, PWSTR pCmdLine, int nCmdSho
     }
 
     tracer.Enable( enableTracer, L"osc.txt", emptyTracerFile );
+    btracer.Enable( enableBinaryTracer, "osc.btr" );
     tracer.Trace( "g_secondsOffset: %lf\n", g_secondsOffset );
 
     if ( 0 == awcInput[0] )
@@ -188,7 +261,34 @@ int WINAPI wWinMain( HINSTANCE hInstance, HINSTANCE, PWSTR pCmdLine, int nCmdSho
         return 0;
     }
 
-    DjlParseWav parseWav( awcInput );
+    // the pipe is declared first so its ring outlives the DjlParseWav viewing it
+
+    CWavPipe pipe;
+    unique_ptr<DjlParseWav> pwav;
+
+    if ( !wcscmp( awcInput, L"-" ) )
+    {
+        if ( 0 != acFilter[0] )
+        {
+            tracer.Trace( "filters aren't supported for streamed input\n" );
+            MessageBox( NULL, L"Filters can't be used with streamed input.", L"error", MB_OK );
+            return 0;
+        }
+
+        if ( !pipe.Start( GetStdHandle( STD_INPUT_HANDLE ), g_streamSeconds, 1.0 / (double) g_updatesPerSecond, rawStream ? &rawFmt : 0 ) )
+        {
+            tracer.Trace( "can't start reading the stream from stdin\n" );
+            MessageBox( NULL, L"Can't read a WAV stream from stdin. Use -w:rate,channels,bits for raw streams, or a smaller -s:n.", L"error", MB_OK );
+            return 0;
+        }
+
+        g_pipe = &pipe;
+        pwav.reset( new DjlParseWav( pipe.GetFmt(), pipe.Ring(), pipe.RingFrames(), pipe.ViewFrames() ) );
+    }
+    else
+        pwav.reset( new DjlParseWav( awcInput ) );
+
+    DjlParseWav & parseWav = * pwav;
     g_pwav = &parseWav;
     if ( !parseWav.SuccessfulParse() )
     {
@@ -197,12 +297,52 @@ int WINAPI wWinMain( HINSTANCE hInstance, HINSTANCE, PWSTR pCmdLine, int nCmdSho
         return 0;
     }
 
+    // unsupported formats and streams just aren't compressed; the bottom text says so
+
+    if ( packSamples && ( parseWav.IsStream() || !parseWav.Pack() ) )
+    {
+        tracer.Trace( "samples won't be compressed\n" );
+        g_packFailed = true;
+    }
+
     DjlParseWav::WavSubchunk &fmt = parseWav.GetFmt();
     g_wavSamples = parseWav.Samples();
-    g_wavSeconds = parseWav.SecondsOfSound();
+
+    // for streams, the offset is how far the view lags the newest sample, up to the length of the ring
+
+    if ( parseWav.IsStream() )
+        g_wavSeconds = (double) pipe.ViewFrames() / (double) fmt.sampleRate;
+    else
+        g_wavSeconds = parseWav.SecondsOfSound();
     g_secondsOffset = __min( g_secondsOffset, g_wavSeconds );
     UpdateCurrentPeriod();
 
+    if ( 0 != acFilter[0] )
+    {
+        if ( !g_filterChain.Parse( acFilter, (double) fmt.sampleRate ) )
+        {
+            tracer.Trace( "can't parse filter specification %s\n", acFilter );
+            MessageBox( NULL, L"Invalid filter specification. Use e.g. -f:hp20,n60,lp8000", L"error", MB_OK );
+            return 0;
+        }
+
+        // only the displayed channels are filtered
+
+        WORD filterChannels = __min( parseWav.Channels(), g_maxChannels );
+        g_filterCache.Init( filterChannels, g_wavSamples, [filterChannels] ( uint64_t first, uint32_t count, double * pdata, uint32_t stride )
+        {
+            BTRACE( "filter reads %u samples at %llu\n", count, first );
+
+            for ( uint32_t i = 0; i < count; i++ )
+                for ( WORD ch = 0; ch < filterChannels; ch++ )
+                    pdata[ i * stride + ch ] = g_pwav->GetSampleInChannel( first + i, ch );
+        } );
+
+        g_filterCache.SetChain( g_filterChain );
+        g_filterEnabled = true;
+        tracer.Trace( "filter %s has %zd stages and a %llu sample warm-up\n", g_filterChain.Description(), g_filterChain.Stages(), g_filterChain.WarmupSamples() );
+    }
+
     HRESULT hr = CoInitializeEx( NULL, COINIT_MULTITHREADED );
     if ( FAILED( hr ) )
     {
@@ -270,6 +410,7 @@ int WINAPI wWinMain( HINSTANCE hInstance, HINSTANCE, PWSTR pCmdLine, int nCmdSho
 
     GdiplusShutdown( gdiplusToken );
     CoUninitialize();
+    btracer.Shutdown();
 
     tracer.Trace( "time to set pixels    %lld ms\n", timeSetPixels / CTimed::NanoPerMilli() );
     tracer.Trace( "time for border text  %lld ms\n", timeBorderText / CTimed::NanoPerMilli() );
@@ -303,20 +444,36 @@ void RenderTextToDC( HDC hdc, RECT & rect )
     COLORREF crTextOld = SetTextColor( hdc, 0x00ff00 );
     UINT taOld = SetTextAlign( hdc, TA_CENTER );
 
-    static WCHAR awcText[ 100 ] = {};
+    static WCHAR awcText[ 160 ] = {};
     swprintf_s( awcText, _countof( awcText ), L"period %wc%wc %lf %ws    amplitude %wc%wc %2.1lf    offset %wc%wc %lf",
                 0x25b2, 0x25bc, g_viewPeriod, NoteToString(), 0x2191, 0x2193, g_amplitudeZoom, 0x2190, 0x2192, g_secondsOffset );
     
     size_t len = wcslen( awcText );
+
+    if ( g_filterEnabled )
+    {
+        swprintf_s( awcText + len, _countof( awcText ) - len, g_filterSuspended ? L"    filter %.40hs (off; zoom in)" : L"    filter %.40hs",
+                    g_filterChain.Description() );
+        len = wcslen( awcText );
+    }
     RECT rectTopText = rect;
     rectTopText.bottom = g_fontHeight;
     ExtTextOut( hdc, rectTopText.right / 2, 0, ETO_OPAQUE, &rectTopText, awcText, (UINT) len, NULL );
 
     // The bottom text never changes; compute it once
-    static WCHAR awcWav[ 100 ] = {};
-    if ( 0 == awcWav[0] )
-        swprintf_s( awcWav, _countof( awcWav ), L"format %ws    channels %d    rate %d    bps %d    seconds %lf",
-                    g_pwav->GetFormatType(), fmt.channels, fmt.sampleRate, fmt.bitsPerSample, (double) g_pwav->Samples() / (double) fmt.sampleRate );
+    static WCHAR awcWav[ 140 ] = {};
+    if ( 0 == awcWav[0] && g_pwav->IsStream() )
+        swprintf_s( awcWav, _countof( awcWav ), L"format %ws    channels %d    rate %d    bps %d    stream window %.1lf seconds%ws",
+                    g_pwav->GetFormatType(), fmt.channels, fmt.sampleRate, fmt.bitsPerSample, g_wavSeconds,
+                    g_packFailed ? L"    not packed" : L"" );
+    else if ( 0 == awcWav[0] && g_pwav->IsPacked() )
+        swprintf_s( awcWav, _countof( awcWav ), L"format %ws    channels %d    rate %d    bps %d    seconds %lf    packed %.0lf%%",
+                    g_pwav->GetFormatType(), fmt.channels, fmt.sampleRate, fmt.bitsPerSample, (double) g_pwav->Samples() / (double) fmt.sampleRate,
+                    100.0 * (double) g_pwav->PackedBytes() / (double) ( g_pwav->Samples() * fmt.blockAlign ) );
+    else if ( 0 == awcWav[0] )
+        swprintf_s( awcWav, _countof( awcWav ), L"format %ws    channels %d    rate %d    bps %d    seconds %lf%ws",
+                    g_pwav->GetFormatType(), fmt.channels, fmt.sampleRate, fmt.bitsPerSample, (double) g_pwav->Samples() / (double) fmt.sampleRate,
+                    g_packFailed ? L"    not packed; reading from the file" : L"" );
 
     len = wcslen( awcWav );
     RECT rectBottomText = rect;
@@ -329,12 +486,10 @@ void RenderTextToDC( HDC hdc, RECT & rect )
     SelectObject( hdc, fontOld );
 } //RenderTextToDC
 
-void RenderBorderToDC( HDC hdc, RECT & rect )
+void RenderBorder( CFrameBuffer & fb, RECT & rect )
 {
     CTimed timedBorderLines( timeBorderLines );
-    Graphics graphics( hdc );
-    SolidBrush brush( Color( 255, 0, 255, 0 ) ); // green
-    Pen pen( &brush, 1.0 );
+    const uint32_t green = 0x00ff00;
 
     assert( rect.bottom & 0x1 );
     assert( rect.right == rect.bottom );
@@ -344,27 +499,113 @@ void RenderBorderToDC( HDC hdc, RECT & rect )
     const int dimm1 = dim - 1;
     const int half = dimm1 / 2;
 
-    struct Line { int x, y, x2, y2; };
-    static const Line lines[] =
+    // the vertical lines cross the text strips, so these are redrawn after the text every frame
+
+    fb.HLine( 0, bsm1, half, green );
+    fb.HLine( dim - bs, dimm1, half, green );
+    fb.HLine( 0, dimm1, bsm1, green );
+    fb.HLine( 0, dimm1, dimm1 - bsm1, green );
+    fb.VLine( bsm1, 0, dimm1, green );
+    fb.VLine( dimm1 - bsm1, 0, dimm1, green );
+} //RenderBorder
+
+// A persistent render target: a top-down 32bpp DIB section selected into a memory DC, with a CFrameBuffer
+// attached to its bits so pixels are written straight into the memory that's blted, copied, or saved.
+
+struct OscFrame
+{
+    HDC hdc;
+    HBITMAP hbmp;
+    HBITMAP hbmpOld;
+    CFrameBuffer fb;
+
+    OscFrame() : hdc( 0 ), hbmp( 0 ), hbmpOld( 0 ) {}
+
+    void Free()
     {
-        0,            half,         bsm1,         half,
-        dim - bs,     half,         dimm1,        half,
-        0,            bsm1,         dimm1,        bsm1,
-        0,            dimm1 - bsm1, dimm1,        dimm1 - bsm1,
-        bsm1,         0,            bsm1,         dimm1,
-        dimm1 - bsm1, 0,            dimm1 - bsm1, dimm1,
-    };
+        if ( 0 != hdc )
+        {
+            SelectObject( hdc, hbmpOld );
+            DeleteObject( hbmp );
+            DeleteDC( hdc );
+            hdc = 0;
+            hbmp = 0;
+            hbmpOld = 0;
+            fb.Attach( 0, 0, 0, 0 );
+        }
+    } //Free
+
+    bool Create( HDC hdcCompat, int width, int height )
+    {
+        Free();
+
+        BITMAPINFO bmi = {};
+        bmi.bmiHeader.biSize = sizeof BITMAPINFOHEADER;
+        bmi.bmiHeader.biWidth = width;
+        bmi.bmiHeader.biHeight = height;  // bottom-up, like the clipboard copy built from its header
+        bmi.bmiHeader.biPlanes = 1;
+        bmi.bmiHeader.biBitCount = 32;
+        bmi.bmiHeader.biCompression = BI_RGB;
+
+        void * pvBits = 0;
+        hdc = CreateCompatibleDC( hdcCompat );
+        hbmp = CreateDIBSection( hdc, &bmi, DIB_RGB_COLORS, &pvBits, 0, 0 );
+        if ( 0 == hdc || 0 == hbmp )
+        {
+            tracer.Trace( "can't create frame DIB section %d x %d: %d\n", width, height, GetLastError() );
+            if ( 0 != hbmp )
+                DeleteObject( hbmp );
+            if ( 0 != hdc )
+                DeleteDC( hdc );
+            hdc = 0;
+            hbmp = 0;
+            return false;
+        }
+
+        hbmpOld = (HBITMAP) SelectObject( hdc, hbmp );
+        // the top row is last in memory
 
-    for ( int l = 0; l < _countof( lines ); l++ )
-        graphics.DrawLine( &pen, lines[l].x, lines[l].y, lines[l].x2, lines[l].y2 );
-} //RenderBorderToDC
+        fb.Attach( (uint32_t *) pvBits + (size_t) ( height - 1 ) * width, width, height, -width );
+        fb.Fill( 0 );
+        tracer.Trace( "created frame %d x %d\n", width, height );
+        return true;
+    } //Create
+};
 
-void RenderToDC( HDC hdc, RECT & rect )
+CFramePool<OscFrame, 2> g_frames;
+
+OscFrame * RenderFrame( HDC hdcCompat, RECT & rect )
 {
+    OscFrame & frame = g_frames.Acquire();
+
+    // Only a size change allocates. Steady-state frames reuse the DIB section and DC.
+
+    if ( !frame.fb.IsSize( rect.right, rect.bottom ) )
+        if ( !frame.Create( hdcCompat, rect.right, rect.bottom ) )
+            return 0;
+
     const DjlParseWav::WavSubchunk & fmt = g_pwav->GetFmt();
-    const DWORD shownSamples = (DWORD) round( (double) fmt.sampleRate * (double) g_viewPeriod );
-    const DWORD firstSample = (DWORD) round( g_secondsOffset * (double) fmt.sampleRate );
-    const DWORD lastSample = __min( firstSample + shownSamples, g_wavSamples );
+    const unsigned __int64 shownSamples = (unsigned __int64) round( (double) fmt.sampleRate * (double) g_viewPeriod );
+    unsigned __int64 firstSample, lastSample;
+
+    if ( g_pwav->IsStream() )
+    {
+        // take the newest count now so the ring's headroom only has to cover reads made during this frame
+
+        g_wavSamples = g_pipe->Frames();
+        g_pwav->SetStreamSamples( g_wavSamples );
+
+        unsigned __int64 delay = (unsigned __int64) round( g_secondsOffset * (double) fmt.sampleRate );
+        lastSample = g_wavSamples - __min( delay, g_wavSamples );
+        firstSample = __max( lastSample - __min( shownSamples, lastSample ), g_pwav->FirstValidSample() );
+        lastSample = __max( firstSample, lastSample );
+    }
+    else
+    {
+        firstSample = (unsigned __int64) round( g_secondsOffset * (double) fmt.sampleRate );
+        lastSample = __min( firstSample + shownSamples, g_wavSamples );
+    }
+
     const double xFactor = (double) ( rect.right - 2 * g_borderSize - 1 ) / (double) shownSamples;
     const double halfBottom = (double) ( ( rect.bottom - 1 ) - 2 * g_borderSize ) / 2.0;
     const COLORREF channelColors[ g_maxChannels ] = { 0xffffff, 0xff0000, 0x00ff00, 0xffff00,
@@ -372,35 +613,44 @@ void RenderToDC( HDC hdc, RECT & rect )
                                                       0x880000, 0x008800, 0x000088, 0x888800,
                                                       0x440000, 0x004400, 0x000044, 0x444400 };
 
-    //tracer.Trace( "g_viewPeriod %.10lf, seconds %lf, shownSamples: %u\n", g_viewPeriod, g_wavSeconds, shownSamples );
+    BTRACE( "render period %.10lf, first %llu, last %llu, shown %llu, amplitude %.1lf\n", g_viewPeriod, firstSample, lastSample, shownSamples, g_amplitudeZoom );
+
+    // GDI may still be writing to the DIB from the prior use of this frame
+
+    GdiFlush();
 
-    Bitmap bmBack( rect.right, rect.bottom, PixelFormat32bppRGB );
-    Rect rectG( 0, 0, rect.right, rect.bottom );
-    BitmapData bd = {};
-    Status status = bmBack.LockBits( &rectG, ImageLockModeRead | ImageLockModeWrite, PixelFormat32bppRGB, &bd );
-    if ( Status::Ok == status )
     {
         CTimed timedSetPixels( timeSetPixels );
-        const int stride = abs( bd.Stride );
-        const int strideby4 = stride / 4;
-        byte * pb = (byte *) bd.Scan0;
-    
-        if ( bd.Stride < 0 )
-            pb += ( bd.Stride * ( rect.bottom - 1 ) );
-    
-        ULONG * pbuf = (ULONG *) pb;
+        CFrameBuffer & fb = frame.fb;
+        fb.ClearDirty( 0 );
+
         const DWORD waveformBottom = rect.bottom - g_borderSize;
         WORD channelCount = __min( g_pwav->Channels(), _countof( channelColors ) );
         const DWORD invalidY = 0xffffffff;
+        // when zoomed out too far to filter within the cache's budget, show the unfiltered data
+
+        g_filterSuspended = g_filterEnabled && !g_filterCache.Prepare( firstSample, lastSample );
+        const bool filtered = g_filterEnabled && !g_filterSuspended;
+
+        if ( lastSample > firstSample )
+        {
+            int xEnd = g_borderSize + (int) round( (double) ( lastSample - 1 - firstSample ) * xFactor ) + 1;
+            fb.MarkDirty( g_borderSize, g_borderSize, xEnd, waveformBottom );
+        }
     
-        parallel_for( firstSample, lastSample, [&] ( DWORD s )
+        parallel_for( firstSample, lastSample, [&] ( unsigned __int64 s )
         {
+            // one record per 4096 samples shows how the samples are split across threads
+
+            if ( 0 == ( s & 0xfff ) )
+                BTRACE( "render sample block %llu\n", s >> 12 );
+
             DWORD x = g_borderSize + (DWORD) round( (double) ( s - firstSample ) * xFactor );
             DWORD yval[ g_maxChannels ];
 
             for ( WORD ch = 0; ch < channelCount; ch++ )
             {
-                double v = g_pwav->GetSampleInChannel( s, ch );
+                double v = filtered ? g_filterCache.Get( s, ch ) : g_pwav->GetSampleInChannel( s, ch );
                 DWORD yv = g_borderSize + SampleToY( v, halfBottom );
                 if ( InWaveformRange( yv, waveformBottom ) )
                     yval[ ch ] = yv;
@@ -422,32 +672,45 @@ void RenderToDC( HDC hdc, RECT & rect )
                         }
                     }
 
-                    pbuf[ strideby4 * yval[ ch ] + x ] = ( anyDuplicates ) ? 0xff : channelColors[ ch ];
+                    fb.Row( yval[ ch ] )[ x ] = ( anyDuplicates ) ? 0xff : channelColors[ ch ];
                 }
             }
         } );
     
-        status = bmBack.UnlockBits( &bd );
-        timedSetPixels.Complete();
+        long long setPixelsNS = timedSetPixels.Complete();
+        BTRACE( "set pixels for %llu samples in %lld ns\n", lastSample - firstSample, setPixelsNS );
+    }
 
-        HDC hdcBack = CreateCompatibleDC( hdc );
-        HBITMAP bmpBack;
-        bmBack.GetHBITMAP( 0, &bmpBack );
-        HBITMAP bmpOld = (HBITMAP) SelectObject( hdcBack, bmpBack );
-    
-        RenderTextToDC( hdcBack, rect );
-        RenderBorderToDC( hdcBack, rect );
+    RenderTextToDC( frame.hdc, rect );
+    GdiFlush();
+    RenderBorder( frame.fb, rect );
+
+    g_frames.Complete( frame );
+    return &frame;
+} //RenderFrame
+
+OscFrame * RenderToDC( HDC hdc, RECT & rect )
+{
+    OscFrame * frame = RenderFrame( hdc, rect );
 
+    if ( 0 != frame )
+    {
         CTimed timedBlt( timeBlt );
-        BitBlt( hdc, 0, 0, rect.right, rect.bottom, hdcBack, 0, 0, SRCCOPY );
+        BitBlt( hdc, 0, 0, rect.right, rect.bottom, frame->hdc, 0, 0, SRCCOPY );
         GdiFlush();
-    
-        SelectObject( hdcBack, bmpOld );
-        DeleteObject( bmpBack );
-        DeleteObject( hdcBack );
+        long long bltNS = timedBlt.Complete();
+        BTRACE( "blt in %lld ns\n", bltNS );
     }
+
+    return frame;
 } //RenderToDC
 
+void FreeFrames()
+{
+    for ( size_t i = 0; i < g_frames.Count(); i++ )
+        g_frames[ i ].Free();
+} //FreeFrames
+
 void PutBitmapInClipboard( HWND hwnd, HBITMAP hbitmap )
 {
     if ( OpenClipboard( hwnd ) )
@@ -473,24 +736,42 @@ void PutBitmapInClipboard( HWND hwnd, HBITMAP hbitmap )
     }
 } //PutBitmapInClipboard
 
-void PutBitmapInFile( HBITMAP hbitmap )
+void PutBitmapInFile( CFrameBuffer & fb )
 {
     CreateDirectory( g_imagesFolder, 0 );
     static WCHAR awcFile[ 100 ];
     const int MaxFile = 1000000;
-    int i = 0;
 
-    do
+    // probe from the last file written so exporting every frame of a stream doesn't rescan the folder
+
+    static int nextFile = 0;
+    int i = nextFile;
+
+    while ( i < MaxFile )
     {
         swprintf_s( awcFile, _countof( awcFile ), L"%ws\\osc-%d.png", g_imagesFolder, i );
         if ( INVALID_FILE_ATTRIBUTES == GetFileAttributes( awcFile ) )
             break;
         i++;
-    } while ( i < MaxFile );
+    }
+
+    nextFile = __min( i + 1, MaxFile );
 
-    if ( i < MaxFile )
+    if ( i >= MaxFile )
     {
-        Bitmap bmp( hbitmap, 0 );
+        static bool reported = false;
+        if ( !reported )
+        {
+            tracer.Trace( "%ws already has %d images; no more will be saved\n", g_imagesFolder, MaxFile );
+            MessageBeep( MB_ICONWARNING );
+            reported = true;
+        }
+    }
+    else
+    {
+        // wrap the frame's pixels rather than copying them
+
+        Bitmap bmp( fb.Width(), fb.Height(), fb.StrideBy4() * 4, PixelFormat32bppRGB, (BYTE *) fb.Row( 0 ) );
         CLSID clsidPNG;
         CLSIDFromString( L"{557cf406-1a04-11d3-9a73-0000f81ef32e}", &clsidPNG );
         bmp.Save( awcFile, &clsidPNG );
@@ -502,44 +783,43 @@ void RenderView( HWND hwnd, bool clipboard )
     RECT rect;
     GetClientRect( hwnd, &rect );
 
-    HDC hdcClip = CreateCompatibleDC( NULL );
-    void *pvBits;
-    BITMAPINFO bmi = {};
-    bmi.bmiHeader.biSize = sizeof BITMAPINFOHEADER;
-    bmi.bmiHeader.biWidth = rect.right;
-    bmi.bmiHeader.biHeight = rect.bottom;
-    bmi.bmiHeader.biPlanes = 1;
-    bmi.bmiHeader.biBitCount = 24;
-    bmi.bmiHeader.biCompression = BI_RGB;
-    HBITMAP bmpClip = CreateDIBSection( hdcClip, &bmi, DIB_RGB_COLORS, &pvBits, 0, 0 );
-    HBITMAP bmpOld = (HBITMAP) SelectObject( hdcClip, bmpClip );
-    
-    RenderToDC( hdcClip, rect );
-    SelectObject( hdcClip, bmpOld );
+    // render rather than reuse the latest frame; the view may have changed since the last paint
+
+    HDC hdc = GetDC( hwnd );
+    OscFrame * frame = RenderFrame( hdc, rect );
+    ReleaseDC( hwnd, hdc );
+
+    if ( 0 == frame )
+        return;
 
     if ( clipboard )
-        PutBitmapInClipboard( hwnd, bmpClip );
+        PutBitmapInClipboard( hwnd, frame->hbmp );
     else
-        PutBitmapInFile( bmpClip );
-    
-    DeleteObject( bmpClip );
-    DeleteDC( hdcClip );
+        PutBitmapInFile( frame->fb );
 } //RenderView
 
 extern "C" INT_PTR WINAPI HelpDialogProc( HWND hdlg, UINT message, WPARAM wParam, LPARAM lParam )
 {
     static const WCHAR * helpText = L"usage:\n"
-                                     "\tosc input [-i] [-o:n] [-p:n] [-r] [-t]\n"
+                                     "\tosc input [-b] [-c] [-f:spec] [-i] [-o:n] [-p:n] [-r] [-s:n] [-t] [-u:n] [-w:r,c,b]\n"
                                      "\n"
                                      "arguments:\n"
-                                     "\tinput\tThe uncompressed WAV file to display\n"
+                                     "\tinput\tThe uncompressed WAV file to display, or - for stdin\n"
+                                     "\t-b\tWrite binary render traces to osc.btr; decode with oscbt\n"
+                                     "\t-c\tCompress samples in memory (lossless) for files larger than RAM\n"
+                                     "\t-f:spec\tFilter the display. spec is a comma-separated chain of\n"
+                                     "\t\thpN/lpN high/low-pass, bpN band-pass, nN notch + harmonics (Hz)\n"
                                      "\t-i\tCreates PNGs in osc_images\\osc-N for each frame shown\n"
                                      "\t-I\tLike -i, but first deletes PNG files in osc_images\\*\n"
                                      "\t-o:n\tOffset; start at n seconds into the WAV file\n"
                                      "\t-p:n\tThe period, where n is A through G above middle C\n"
                                      "\t-r\tIgnore prior window position stored in the registry\n"
+                                     "\t-s:n\tFor stdin, keep the most recent n seconds. Default 10\n"
                                      "\t-t\tAppend debugging traces to osc.txt\n"
                                      "\t-T\tLike -t, bur first delete osc.txt\n"
+                                     "\t-u:n\tFor stdin, update n times per second. Default 30\n"
+                                     "\t-w:r,c,b\tstdin is raw PCM: rate,channels,bits. Add ,f for float\n"
+                                     "\t\t8-bit is unsigned; 16, 24, and 32-bit are signed\n"
                                      "\n"
                                      "mouse:\n"
                                      "\tleft-click \tmove the window\n"
@@ -557,6 +837,7 @@ extern "C" INT_PTR WINAPI HelpDialogProc( HWND hdlg, UINT message, WPARAM wParam
                                      "\tDown Arrow\tDecrease amplitude\n"
                                      "\tRight Arrow\tShift right in the WAV file\n"
                                      "\tLeft Arrow\tShift left in the WAV file\n"
+                                     "\tf          \ttoggle the -f filter on/off\n"
                                      "\tq or esc   \tquit the application\n"
                                      "\n"
                                      "sample usage:\n"
@@ -564,9 +845,11 @@ extern "C" INT_PTR WINAPI HelpDialogProc( HWND hdlg, UINT message, WPARAM wParam
                                      "\tosc myfile.wav -o:30.2\n"
                                      "\tosc myfile.wav -p:f\n"
                                      "\tosc d:\\songs\\myfile.wav -T -p:g -o:0.5\n"
+                                     "\tosc myfile.wav -f:hp20,n60\n"
+                                     "\tcapture | osc - -w:48000,2,16 -s:5\n"
                                      "\n"
                                      "notes:\n"
-                                     "\tOnly uncompressed WAV files are supported\n"
+                                     "\tOnly uncompressed WAV, RF64, BW64, and W64 files are supported\n"
                                      "\tChannel 0 (left) is white. 1 is Red. Shared values are Blue.\n"
                                      "\tOnly the first 16 channels are displayed\n";
 
@@ -590,7 +873,17 @@ extern "C" INT_PTR WINAPI HelpDialogProc( HWND hdlg, UINT message, WPARAM wParam
 
 void PanLeft( HWND hwnd )
 {
-    if ( g_secondsOffset > 0.0 )
+    // streams measure the offset back from the newest sample, so left is a larger offset
+
+    if ( g_pwav->IsStream() )
+    {
+        if ( g_secondsOffset < g_wavSeconds )
+        {
+            g_secondsOffset = __min( g_wavSeconds, g_secondsOffset + ( g_viewPeriod / 10.0 ) );
+            InvalidateRect( hwnd, NULL, TRUE );
+        }
+    }
+    else if ( g_secondsOffset > 0.0 )
     {
         g_secondsOffset = __max( 0.0, g_secondsOffset - ( g_viewPeriod / 10.0 ) );
         InvalidateRect( hwnd, NULL, TRUE );
@@ -599,7 +892,15 @@ void PanLeft( HWND hwnd )
 
 void PanRight( HWND hwnd )
 {
-    if ( g_secondsOffset < g_wavSeconds )
+    if ( g_pwav->IsStream() )
+    {
+        if ( g_secondsOffset > 0.0 )
+        {
+            g_secondsOffset = __max( 0.0, g_secondsOffset - ( g_viewPeriod / 10.0 ) );
+            InvalidateRect( hwnd, NULL, TRUE );
+        }
+    }
+    else if ( g_secondsOffset < g_wavSeconds )
     {
         g_secondsOffset = __min( g_wavSeconds, g_secondsOffset + ( g_viewPeriod / 10.0 ) );
         InvalidateRect( hwnd, NULL, TRUE );
@@ -655,6 +956,9 @@ LRESULT CALLBACK WindowProc( HWND hwnd, UINT uMsg, WPARAM wParam, LPARAM lParam
         case WM_CREATE:
         {
             hContextMenu = LoadMenu( NULL, MAKEINTRESOURCE( ID_OSC_POPUPMENU ) );
+
+            if ( 0 != g_pipe )
+                SetTimer( hwnd, g_streamTimer, 1000 / g_updatesPerSecond, NULL );
             break;
         }
 
@@ -663,6 +967,11 @@ LRESULT CALLBACK WindowProc( HWND hwnd, UINT uMsg, WPARAM wParam, LPARAM lParam
             if ( 0 != hContextMenu )
                 DestroyMenu( hContextMenu );
 
+            if ( 0 != g_pipe )
+                KillTimer( hwnd, g_streamTimer );
+
+            FreeFrames();
+
             RECT rectPos;
             GetWindowRect( hwnd, &rectPos );
 
@@ -674,10 +983,36 @@ LRESULT CALLBACK WindowProc( HWND hwnd, UINT uMsg, WPARAM wParam, LPARAM lParam
             return 0;
         }
 
+        case WM_TIMER:
+        {
+            // render whatever has arrived since the last tick. Nothing is allocated per frame
+
+            if ( g_streamTimer == wParam && 0 != g_pipe )
+            {
+                unsigned __int64 frames = g_pipe->Frames();
+
+                if ( frames != g_wavSamples )
+                {
+                    g_wavSamples = frames;
+                    g_pwav->SetStreamSamples( frames );
+                    InvalidateRect( hwnd, NULL, FALSE );
+                }
+                else if ( g_pipe->Ended() )
+                    KillTimer( hwnd, g_streamTimer );
+            }
+
+            return 0;
+        }
+
         case WM_CHAR:
         {
             if ( 'q' == wParam || 0x1b == wParam ) // q or ESC
                 DestroyWindow( hwnd );
+            else if ( 'f' == wParam && !g_filterChain.IsEmpty() )
+            {
+                g_filterEnabled = !g_filterEnabled;
+                InvalidateRect( hwnd, NULL, TRUE );
+            }
             return 0;
         }
 
@@ -693,17 +1028,19 @@ LRESULT CALLBACK WindowProc( HWND hwnd, UINT uMsg, WPARAM wParam, LPARAM lParam
 
         case WM_PAINT:
         {
-            if ( g_createImages )
-                RenderView( hwnd, false );
-
             RECT rect;
             GetClientRect( hwnd, &rect );
 
             PAINTSTRUCT ps;
             HDC hdc = BeginPaint( hwnd, &ps );
-            RenderToDC( hdc, rect );
+            OscFrame * frame = RenderToDC( hdc, rect );
             EndPaint( hwnd, &ps );
 
+            // save the frame that was just shown rather than rendering it a second time
+
+            if ( g_createImages && 0 != frame )
+                PutBitmapInFile( frame->fb );
+
             return 0;
         }
 
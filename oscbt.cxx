@@ -0,0 +1,67 @@
+//
+// Decodes binary trace files written by osc -b into text
+//
+
+#define _CRT_SECURE_NO_WARNINGS
+
+#include <stdio.h>
+
+#include <djl_btrace.hxx>
+
+CDJLBinaryTrace btracer;
+
+void Usage()
+{
+    printf( "usage: oscbt [input] [output]\n" );
+    printf( "  arguments:\n" );
+    printf( "    input      Binary trace file. Default is osc.btr\n" );
+    printf( "    output     Text file to create. Default is the console\n" );
+    exit( 1 );
+} //Usage
+
+int main( int argc, char * argv[] )
+{
+    const char * pcIn = "osc.btr";
+    const char * pcOut = 0;
+
+    for ( int i = 1; i < argc; i++ )
+    {
+        if ( '-' == argv[ i ][ 0 ] || '/' == argv[ i ][ 0 ] )
+            Usage();
+        else if ( 2 == i )
+            pcOut = argv[ i ];
+        else
+            pcIn = argv[ i ];
+    }
+
+    CFile fileIn( fopen( pcIn, "rb" ) );
+    if ( 0 == fileIn.get() )
+    {
+        printf( "can't open input file %s\n", pcIn );
+        Usage();
+    }
+
+    FILE * fpOut = stdout;
+    if ( 0 != pcOut )
+    {
+        fpOut = fopen( pcOut, "w" );
+        if ( 0 == fpOut )
+        {
+            printf( "can't create output file %s\n", pcOut );
+            Usage();
+        }
+    }
+
+    bool ok = CDJLBinaryTrace::Decode( fileIn.get(), fpOut );
+
+    if ( stdout != fpOut )
+        fclose( fpOut );
+
+    if ( !ok )
+    {
+        printf( "%s isn't a binary trace file or is truncated\n", pcIn );
+        return 1;
+    }
+
+    return 0;
+} //main